@@ -0,0 +1,426 @@
+/*
+ * write_kv/read_kv 微基准，在 only_kernel 的 QEMU 里跑：
+ *
+ *   make kv_bench
+ *   kv_bench [-n ops] [-t threads] [-d ms] [-k keys] [-s sections]
+ *
+ * 每个结果输出一行 JSON，方便和上一个内核的结果逐行对比：
+ *   latency  单线程每次调用的延迟分位数
+ *   scaling  1..N 个线程的吞吐（90% 读、10% 写）
+ *   dist     键的分布对吞吐的影响：顺序、均匀、Zipf、k & 0x3FF 全部相同
+ *   fork     有表和没表时 fork+exit+wait 的耗时
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef __NR_write_kv
+#define __NR_write_kv 449
+#endif
+#ifndef __NR_read_kv
+#define __NR_read_kv 450
+#endif
+
+static long ops = 200000;	/* latency/dist 每项的调用次数 */
+static int max_threads;		/* 默认取在线 CPU 数 */
+static long duration_ms = 1000;	/* scaling 每档的时长 */
+static int keyspace = 65536;
+static const char *sections = "latency,scaling,dist,fork";
+
+static inline long write_kv(int k, int v)
+{
+	return syscall(__NR_write_kv, k, v);
+}
+
+static inline long read_kv(int k)
+{
+	return syscall(__NR_read_kv, k);
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*，每个线程一份状态 */
+static inline uint64_t rnd(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*s = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* Zipf(s=1) 的累积分布，按二分查找取样；不用 libm，ctest 目标不链接 -lm */
+static double *zipf_cdf;
+
+static void zipf_init(int n)
+{
+	double sum = 0;
+	int i;
+
+	zipf_cdf = malloc(sizeof(*zipf_cdf) * n);
+	if (!zipf_cdf) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		sum += 1.0 / (i + 1);
+		zipf_cdf[i] = sum;
+	}
+	for (i = 0; i < n; i++)
+		zipf_cdf[i] /= sum;
+}
+
+static int zipf_key(uint64_t *s)
+{
+	double u = (rnd(s) >> 11) * (1.0 / 9007199254740992.0);
+	int lo = 0, hi = keyspace - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (zipf_cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+enum dist { DIST_SEQ, DIST_UNIFORM, DIST_ZIPF, DIST_COLLIDE };
+
+static const char *dist_name[] = { "sequential", "uniform", "zipf", "collide" };
+
+static int next_key(enum dist d, long i, uint64_t *s)
+{
+	switch (d) {
+	case DIST_SEQ:
+		return i % keyspace;
+	case DIST_UNIFORM:
+		return rnd(s) % keyspace;
+	case DIST_ZIPF:
+		return zipf_key(s);
+	case DIST_COLLIDE:
+	default:
+		/* 低 10 位都一样，旧的 1024 桶实现会全部落进同一个桶 */
+		return (int)(rnd(s) % keyspace) << 10 | 0x155;
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report_latency(const char *op, uint64_t *lat, long n)
+{
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+	printf("{\"bench\":\"latency\",\"op\":\"%s\",\"n\":%ld,"
+	       "\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,"
+	       "\"p999_ns\":%llu,\"max_ns\":%llu}\n", op, n,
+	       (unsigned long long)lat[n / 2],
+	       (unsigned long long)lat[n * 9 / 10],
+	       (unsigned long long)lat[n * 99 / 100],
+	       (unsigned long long)lat[n * 999 / 1000],
+	       (unsigned long long)lat[n - 1]);
+	fflush(stdout);
+}
+
+static void bench_latency(void)
+{
+	uint64_t *lat = malloc(sizeof(*lat) * ops);
+	uint64_t t, s = 1;
+	long i;
+
+	if (!lat) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = 0; i < ops; i++) {
+		int k = rnd(&s) % keyspace;
+
+		t = now_ns();
+		write_kv(k, (int)i);
+		lat[i] = now_ns() - t;
+	}
+	report_latency("write_kv", lat, ops);
+
+	for (i = 0; i < ops; i++) {
+		int k = rnd(&s) % keyspace;
+
+		t = now_ns();
+		read_kv(k);
+		lat[i] = now_ns() - t;
+	}
+	report_latency("read_kv", lat, ops);
+
+	/* 键空间之外，必然未命中 */
+	for (i = 0; i < ops; i++) {
+		t = now_ns();
+		read_kv(-1 - (int)(i % keyspace));
+		lat[i] = now_ns() - t;
+	}
+	report_latency("read_kv_miss", lat, ops);
+
+	for (i = 0; i < ops; i++) {
+		t = now_ns();
+		syscall(__NR_getppid);
+		lat[i] = now_ns() - t;
+	}
+	report_latency("getppid", lat, ops);	/* 空系统调用作为基线 */
+	free(lat);
+}
+
+struct worker {
+	pthread_t tid;
+	uint64_t seed;
+	long ops;
+};
+
+static volatile int start_flag, stop_flag;
+
+static void *scaling_worker(void *arg)
+{
+	struct worker *w = arg;
+	long n = 0;
+
+	while (!__atomic_load_n(&start_flag, __ATOMIC_ACQUIRE))
+		;
+	while (!__atomic_load_n(&stop_flag, __ATOMIC_RELAXED)) {
+		uint64_t r = rnd(&w->seed);
+		int k = r % keyspace;
+
+		if ((r >> 32) % 10 == 0)
+			write_kv(k, (int)n);
+		else
+			read_kv(k);
+		n++;
+	}
+	w->ops = n;
+	return NULL;
+}
+
+static void bench_scaling(void)
+{
+	struct worker *w = calloc(max_threads, sizeof(*w));
+	struct timespec ts = {
+		.tv_sec = duration_ms / 1000,
+		.tv_nsec = (duration_ms % 1000) * 1000000,
+	};
+	int nr, i;
+
+	if (!w) {
+		perror("calloc");
+		exit(1);
+	}
+	/* 先把键空间写满，读都能命中 */
+	for (i = 0; i < keyspace; i++)
+		write_kv(i, i);
+
+	for (nr = 1; nr <= max_threads; nr++) {
+		uint64_t t, total = 0;
+
+		start_flag = stop_flag = 0;
+		for (i = 0; i < nr; i++) {
+			w[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+			if (pthread_create(&w[i].tid, NULL, scaling_worker, &w[i])) {
+				perror("pthread_create");
+				exit(1);
+			}
+		}
+		t = now_ns();
+		__atomic_store_n(&start_flag, 1, __ATOMIC_RELEASE);
+		nanosleep(&ts, NULL);
+		__atomic_store_n(&stop_flag, 1, __ATOMIC_RELAXED);
+		for (i = 0; i < nr; i++) {
+			pthread_join(w[i].tid, NULL);
+			total += w[i].ops;
+		}
+		t = now_ns() - t;
+		printf("{\"bench\":\"scaling\",\"threads\":%d,\"ops\":%llu,"
+		       "\"ns\":%llu,\"ops_per_sec\":%.0f}\n", nr,
+		       (unsigned long long)total, (unsigned long long)t,
+		       total * 1e9 / t);
+		fflush(stdout);
+	}
+	free(w);
+}
+
+static void bench_dist(void)
+{
+	enum dist d;
+
+	zipf_init(keyspace);
+	for (d = DIST_SEQ; d <= DIST_COLLIDE; d++) {
+		uint64_t s = 42, t, tw, tr;
+		long i;
+
+		/* 每种分布在新的子进程里跑，从空表开始 */
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid) {
+			waitpid(pid, NULL, 0);
+			continue;
+		}
+		t = now_ns();
+		for (i = 0; i < ops; i++)
+			write_kv(next_key(d, i, &s), (int)i);
+		tw = now_ns() - t;
+		s = 42;
+		t = now_ns();
+		for (i = 0; i < ops; i++)
+			read_kv(next_key(d, i, &s));
+		tr = now_ns() - t;
+		printf("{\"bench\":\"dist\",\"dist\":\"%s\",\"n\":%ld,"
+		       "\"write_ns_per_op\":%.1f,\"read_ns_per_op\":%.1f}\n",
+		       dist_name[d], ops, (double)tw / ops, (double)tr / ops);
+		fflush(stdout);
+		_exit(0);
+	}
+	free(zipf_cdf);
+}
+
+/* fork+立即 _exit+waitpid 的平均耗时 */
+static double fork_cost(int rounds)
+{
+	uint64_t t = now_ns();
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (!pid)
+			_exit(0);
+		waitpid(pid, NULL, 0);
+	}
+	return (double)(now_ns() - t) / rounds;
+}
+
+static void bench_fork(void)
+{
+	const int rounds = 2000;
+	pid_t pid = fork();
+	int i;
+
+	/* 在子进程里量，不受前面各项留下的表影响 */
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid) {
+		waitpid(pid, NULL, 0);
+		return;
+	}
+	printf("{\"bench\":\"fork\",\"table\":false,\"entries\":0,"
+	       "\"ns_per_fork\":%.0f}\n", fork_cost(rounds));
+	for (i = 0; i < keyspace; i++)
+		write_kv(i, i);
+	printf("{\"bench\":\"fork\",\"table\":true,\"entries\":%d,"
+	       "\"ns_per_fork\":%.0f}\n", keyspace, fork_cost(rounds));
+	fflush(stdout);
+	_exit(0);
+}
+
+static int want(const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = sections;
+
+	while ((p = strstr(p, name))) {
+		if ((p == sections || p[-1] == ',') &&
+		    (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n ops] [-t threads] [-d ms] [-k keys] [-s sections]\n"
+		"  sections: comma separated subset of %s\n", prog, sections);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct utsname uts;
+	int opt;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "n:t:d:k:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			ops = atol(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'd':
+			duration_ms = atol(optarg);
+			break;
+		case 'k':
+			keyspace = atoi(optarg);
+			break;
+		case 's':
+			sections = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (ops <= 0 || max_threads <= 0 || duration_ms <= 0 || keyspace <= 0 ||
+	    keyspace > (1 << 20))
+		usage(argv[0]);
+
+	/* 确认内核带了 KV 系统调用，否则结果没有意义 */
+	if (read_kv(0) == -1 && errno == ENOSYS) {
+		fprintf(stderr, "kv_bench: write_kv/read_kv not implemented\n");
+		return 1;
+	}
+
+	uname(&uts);
+	printf("{\"bench\":\"info\",\"kernel\":\"%s\",\"cpus\":%ld,"
+	       "\"ops\":%ld,\"threads\":%d,\"duration_ms\":%ld,\"keys\":%d}\n",
+	       uts.release, sysconf(_SC_NPROCESSORS_ONLN), ops, max_threads,
+	       duration_ms, keyspace);
+	fflush(stdout);
+
+	if (want("fork"))
+		bench_fork();
+	if (want("dist"))
+		bench_dist();
+	if (want("latency"))
+		bench_latency();
+	if (want("scaling"))
+		bench_scaling();
+	return 0;
+}
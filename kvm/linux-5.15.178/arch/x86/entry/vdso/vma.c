@@ -34,6 +34,8 @@
 
 #include <linux/sched.h>
 #include <linux/vdso_task.h>
+#include <linux/kv_store.h>
+#include <linux/kv_vindex.h>
 
 
 // #define VTASK_SIZE  ALIGN(sizeof(struct task_struct), PAGE_SIZE)
@@ -369,6 +371,25 @@ static vm_fault_t vtask_fault(
 //     return 0;
 // }
 
+/*
+ * [vkv]：KV 表的只读快照，页面归线程组的 KV 表所有，第一次访问时才创建；
+ * 线程组还没有表时映射一个空页，见 vkv_reset()。
+ * 这里映射的是普通页，不是 PFN，页表持有引用，表先释放也不会有问题。
+ */
+static vm_fault_t vkv_fault(const struct vm_special_mapping *sm,
+			    struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct page *page;
+
+	BUILD_BUG_ON(VVAR_KV_NR_PAGES != KV_VINDEX_PAGES);
+	if (vmf->pgoff >= VVAR_KV_NR_PAGES)
+		return VM_FAULT_SIGBUS;
+	page = kv_vindex_page(vmf->pgoff);
+	if (!page)
+		return VM_FAULT_OOM;
+	vmf->page = page;
+	return 0;
+}
 
 static const struct vm_special_mapping vdso_mapping = {
 	.name = "[vdso]",
@@ -383,6 +404,27 @@ static const struct vm_special_mapping vtask_mapping = {
 	.name = "[vtask]",
     .fault = vtask_fault,
 };
+static const struct vm_special_mapping vkv_mapping = {
+	.name = "[vkv]",
+	.fault = vkv_fault,
+};
+/*
+ * 线程组刚装上 KV 表，清掉 [vkv] 的页表，之前映射的可能是空页。
+ * 拿写锁是为了和正在进行的缺页互斥：装表在前，之后的缺页都能看到。
+ */
+void vkv_reset(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+
+	mmap_write_lock(mm);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma_is_special_mapping(vma, &vkv_mapping))
+			zap_page_range(vma, vma->vm_start,
+				       vma->vm_end - vma->vm_start);
+	}
+	mmap_write_unlock(mm);
+}
+
 static void print_stack_region(void)
 {
     struct mm_struct *mm = current->mm;
@@ -418,14 +460,16 @@ static int map_vdso(const struct vdso_image *image, unsigned long addr)
 	struct vm_area_struct *vma;
 	unsigned long text_start;
 	unsigned long vtask_addr = 0;    // 新增
+	unsigned long vkv_addr;
 	int ret = 0;
 
 	if (mmap_write_lock_killable(mm))
 		return -EINTR;
 
 	addr = get_unmapped_area(NULL, addr,
-				 image->size - image->sym_vvar_start + VTASK_SIZE, 0, 0);
-	addr += VTASK_SIZE;
+				 image->size - image->sym_vvar_start + VTASK_SIZE + VKV_SIZE,
+				 0, 0);
+	addr += VTASK_SIZE + VKV_SIZE;
 	if (IS_ERR_VALUE(addr)) {
 		ret = addr;
 		goto up_fail;
@@ -479,6 +523,21 @@ static int map_vdso(const struct vdso_image *image, unsigned long addr)
         do_munmap(mm, text_start, image->size, NULL);
 		goto up_fail;
     } 
+
+	/* 只读，fork 后子进程重新缺页拿自己的快照 */
+	vkv_addr = vtask_addr - VKV_SIZE;
+	vma = _install_special_mapping(mm,
+				       vkv_addr,
+				       VKV_SIZE,
+				       VM_READ|VM_MAYREAD|VM_DONTDUMP|VM_WIPEONFORK,
+				       &vkv_mapping);
+	if (IS_ERR(vma)) {
+		ret = PTR_ERR(vma);
+		do_munmap(mm, vtask_addr, VTASK_SIZE, NULL);
+		do_munmap(mm, addr, -image->sym_vvar_start, NULL);
+		do_munmap(mm, text_start, image->size, NULL);
+		goto up_fail;
+	}
 	//printk(KERN_INFO "pass checkpoint 3\n");
     current->mm->context.vdso = (void __user *)text_start;
     current->mm->context.vdso_image = image;
@@ -561,6 +620,7 @@ int map_vdso_once(const struct vdso_image *image, unsigned long addr)
 		if (vma_is_special_mapping(vma, &vdso_mapping) ||
 				vma_is_special_mapping(vma, &vvar_mapping)
 				||vma_is_special_mapping(vma, &vtask_mapping)
+				||vma_is_special_mapping(vma, &vkv_mapping)
 			) {
 			mmap_write_unlock(mm);
 			return -EEXIST;
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * vDSO implementation of read_kv: look the key up in the [vkv] snapshot
+ */
+
+#include <linux/types.h>
+#include <linux/kv_vindex.h>
+#include <asm/unistd.h>
+#include <asm/vgtod.h>
+#include <asm/vdso.h>
+#include <asm/vvar.h>
+#include <asm/processor.h>
+#include <asm/barrier.h>
+
+/* seq 一直在变时最多重试这么多次，然后走系统调用 */
+#define VREAD_KV_RETRIES	4
+
+static __always_inline long read_kv_fallback(int k)
+{
+	long ret;
+
+	asm volatile ("syscall"
+		      : "=a" (ret)
+		      : "0" (__NR_read_kv), "D" (k)
+		      : "rcx", "r11", "memory");
+	return ret;
+}
+
+/*
+ * 与 sys_read_kv 的返回值一致：命中返回值，不存在返回 -2。
+ * 快照为空、不完整（还在灌数据或槽位已满）或一直读不到一致的结果时，
+ * 交给系统调用处理，表为空时的 -3 也由它返回。
+ */
+int __vdso_read_kv(int k)
+{
+	const struct vdso_data *vdata = __arch_get_vdso_data();
+	struct kv_vindex_hdr *hdr;
+	struct kv_vslot *slots;
+	int tries;
+
+	/* [vkv] 紧挨在 [vtask] 下面 */
+	hdr = (struct kv_vindex_hdr *)(((unsigned long)vdata >> PAGE_SHIFT << PAGE_SHIFT) -
+				       (VVAR_TASK_STRUCT_NR_PAGES + VVAR_KV_NR_PAGES) * PAGE_SIZE);
+	slots = kv_vindex_slots(hdr);
+
+	for (tries = 0; tries < VREAD_KV_RETRIES; tries++) {
+		u32 seq, flags, nr_used, i, n;
+		bool found = false;
+		int v = 0;
+
+		seq = READ_ONCE(hdr->seq);
+		if (seq & 1) {
+			cpu_relax();
+			continue;
+		}
+		smp_rmb();
+
+		if (READ_ONCE(hdr->magic) != KV_VINDEX_MAGIC)
+			break;
+		flags = READ_ONCE(hdr->flags);
+		if (flags & KV_VINDEX_BYPASS)
+			break;
+		nr_used = READ_ONCE(hdr->nr_used);
+		i = kv_vindex_hash(k);
+		/* 探测次数不超过槽位数，读到撕裂的数据也不会死循环 */
+		for (n = 0; n < KV_VINDEX_SLOTS; n++) {
+			if (!READ_ONCE(slots[i].used))
+				break;
+			if (READ_ONCE(slots[i].key) == k) {
+				v = READ_ONCE(slots[i].value);
+				found = true;
+				break;
+			}
+			i = (i + 1) & (KV_VINDEX_SLOTS - 1);
+		}
+
+		smp_rmb();
+		if (READ_ONCE(hdr->seq) != seq)
+			continue;
+
+		if (found)
+			return v;
+		if (flags || !nr_used)
+			break;
+		return -2;
+	}
+	return read_kv_fallback(k);
+}
+
+int read_kv(int k)
+	__attribute__((weak, alias("__vdso_read_kv")));
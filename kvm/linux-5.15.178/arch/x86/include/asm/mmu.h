@@ -14,6 +14,7 @@
 #define MM_CONTEXT_HAS_VSYSCALL	BIT(1)
 
 #define VTASK_SIZE (PAGE_SIZE * VVAR_TASK_STRUCT_NR_PAGES)
+#define VKV_SIZE (PAGE_SIZE * VVAR_KV_NR_PAGES)
 /*
  * x86 has arch-specific MMU state beyond what lives in mm_struct.
  */
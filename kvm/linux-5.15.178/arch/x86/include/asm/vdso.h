@@ -8,6 +8,8 @@
 
 /* 为task_struct添加额外的VVAR页 */
 #define VVAR_TASK_STRUCT_NR_PAGES (6) /* 根据实际task_struct大小调整 */
+/* [vkv] 的页数，放在 [vtask] 下面，与 KV_VINDEX_PAGES 一致 */
+#define VVAR_KV_NR_PAGES (17)
 /*
 *#define VVAR_NR_PAGES     (2)
 *#define VVAR_TOTAL_PAGES  (VVAR_NR_PAGES + VVAR_TASK_STRUCT_NR_PAGES)
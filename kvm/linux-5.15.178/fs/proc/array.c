@@ -92,6 +92,8 @@
 #include <linux/string_helpers.h>
 #include <linux/user_namespace.h>
 #include <linux/fs_struct.h>
+#include <linux/kv_store.h>
+#include <linux/socket_attrs.h>
 
 #include <asm/processor.h>
 #include "internal.h"
@@ -447,9 +449,19 @@ int proc_pid_status(struct seq_file *m, struct pid_namespace *ns,
 	cpuset_task_status_allowed(m, task);
 	task_context_switch_counts(m, task);
 	// 添加套接字相关信息
-    seq_printf(m, "SocketCount:\t%d\n", task->socket_count);
+    seq_printf(m, "SocketCount:\t%d\n", sock_acct_count(task));
+    seq_printf(m, "GroupSocketCount:\t%d\n", sock_acct_group_count(task));
     seq_printf(m, "MaxSockets:\t%d\n", task->max_socket_allowed);
     seq_printf(m, "SocketPriority:\t%d\n", task->priority_level);
+    /* 收发量能看出别人在通信什么，和 io 一样要求能 ptrace 读 */
+    if (ptrace_may_access(task, PTRACE_MODE_READ_FSCREDS | PTRACE_MODE_NOAUDIT)) {
+        seq_printf(m, "SocketTxBytes:\t%llu\n", READ_ONCE(task->sock_tx_bytes));
+        seq_printf(m, "SocketTxMessages:\t%llu\n", READ_ONCE(task->sock_tx_msgs));
+        seq_printf(m, "SocketRxBytes:\t%llu\n", READ_ONCE(task->sock_rx_bytes));
+        seq_printf(m, "SocketRxMessages:\t%llu\n", READ_ONCE(task->sock_rx_msgs));
+    }
+    seq_printf(m, "SocketRate:\t%llu\n", READ_ONCE(task->sock_rate));
+    seq_printf(m, "SocketBurst:\t%llu\n", READ_ONCE(task->sock_burst));
     
 	return 0;
 }
@@ -699,6 +711,14 @@ int proc_pid_statm(struct seq_file *m, struct pid_namespace *ns,
 	return 0;
 }
 
+/* /proc/<pid>/kv_stats：线程组 KV 表的统计 */
+int proc_pid_kv_stats(struct seq_file *m, struct pid_namespace *ns,
+			struct pid *pid, struct task_struct *task)
+{
+	kv_store_show_stats(m, task);
+	return 0;
+}
+
 #ifdef CONFIG_PROC_CHILDREN
 static struct pid *
 get_children_pid(struct inode *inode, struct pid *pid_prev, loff_t pos)
@@ -0,0 +1,130 @@
+#ifndef _LINUX_KV_STORE_H
+#define _LINUX_KV_STORE_H
+
+#include <linux/cache.h>
+#include <linux/types.h>
+#include <linux/refcount.h>
+#include <linux/workqueue.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock_types.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/rhashtable-types.h>
+#include <uapi/linux/kv_store.h>
+
+/*
+ * 进程的 KV 表，同一线程组的线程共享一份，挂在 group_leader->kv_store 上，
+ * 第一次写入时才分配。
+ * 每个段是一张 rhashtable，按元素个数在线扩缩容，查找在 RCU 下无锁进行。
+ */
+struct kv_pcpu_stats {
+	u64 hits;			/* 查找命中 */
+	u64 misses;			/* 查找未命中 */
+	u64 inserts;
+	u64 updates;			/* 原地更新和替换节点都算 */
+	u64 deletes;
+	u64 contended;			/* 锁争用、插入/替换/删除时与别的写者撞车 */
+	u64 cow_copies;			/* 写时复制了多少个段 */
+	u64 expired;			/* 被周期清理摘掉的过期条目 */
+	u64 evictions;			/* 容量满时被 CLOCK 淘汰的条目 */
+};
+
+/* 绕表转圈的遍历位置：第 idx 段里 rhashtable_iter 的 slot/skip */
+struct kv_cursor {
+	unsigned int idx;
+	unsigned int slot;
+	unsigned int skip;
+};
+
+/* KV_MODE_INHERIT 的表分成这么多段，写时复制以段为单位 */
+#define KV_SEG_BITS	6
+
+struct kv_store {
+	/*
+	 * 字段按访问方式分三组，各自从缓存行开头排：前面是引用计数和
+	 * 释放、fork 才碰的字段；中间是写者会改的锁和清理、淘汰状态；
+	 * 最后是每次读写都要看、创建后基本不变的配置和段指针。
+	 */
+	refcount_t users;		/* 引用计数，组长持有一个 */
+	struct rcu_work free_rwork;
+	wait_queue_head_t fork_wait;	/* fork 和被它挡住的写者在这里等 */
+	struct mutex cow_lock;		/* 串行化段的写时复制 */
+
+	/* 保护 ordered，也串行化有序模式下的写者 */
+	spinlock_t ordered_lock ____cacheline_aligned_in_smp;
+	struct rb_root ordered;		/* KV_MODE_ORDERED：按键排序的索引 */
+	struct mutex evict_lock;	/* 保护 hand */
+	struct kv_cursor hand;		/* CLOCK 的指针 */
+	struct delayed_work expire_work;
+	struct kv_cursor sweep;		/* 过期清理的游标，只在 expire_work 里用 */
+	unsigned long sweep_left;	/* 本轮还要看多少个条目，同上 */
+	bool sweep_timed;		/* 本轮见过带过期时间的条目，同上 */
+
+	unsigned int mode ____cacheline_aligned_in_smp;	/* KV_MODE_*，创建后不变 */
+	unsigned int seg_bits;		/* 段数为 1 << seg_bits */
+	int max_entries;		/* 条目上限，0 表示不限制 */
+	unsigned int capacity;		/* 条目数到这里就按 CLOCK 淘汰，0 表示不限制 */
+	unsigned int default_ttl;	/* 毫秒，新写入的条目按它过期，0 表示不过期 */
+	bool ttl_used;			/* 用过过期时间，fork 时子表也要清理 */
+	bool ttl_fresh;			/* 本轮清理开始后又写过带过期时间的条目 */
+	/* KV_MODE_INHERIT：fork 与写者互斥，见 kv_fork_lock() */
+	int __percpu *writers;		/* 正在写的线程数，按 CPU 分开记 */
+	int forking;			/* fork 正在共享段，新写者要等 */
+	/* KV_MODE_INHERIT：哪些段只属于这张表，可以原地修改 */
+	DECLARE_BITMAP(owned, 1U << KV_SEG_BITS);
+	struct kv_pcpu_stats __percpu *stats;
+	struct kv_vindex *vindex;	/* [vkv] 只读快照，第一次映射时创建 */
+	struct kv_seg __rcu *segs[];
+};
+
+/* 不超过这个长度的值直接存在条目里 */
+#define KV_INLINE_SIZE	16
+
+struct task_struct;
+struct seq_file;
+struct pid_namespace;
+struct pid;
+struct page;
+struct mm_struct;
+struct kv_vindex;
+struct kv_seg;
+struct ipc_namespace;
+
+void kv_store_get(struct kv_store *kv);
+void kv_store_put(struct kv_store *kv);
+struct kv_store *kv_store_get_task(struct task_struct *task);
+void kv_store_show_stats(struct seq_file *m, struct task_struct *task);
+/*
+ * fs/proc/array.c，/proc/<pid>/kv_stats 的 show 函数，在 fs/proc/base.c 的
+ * tgid_base_stuff 里以 ONE("kv_stats", S_IRUSR, proc_pid_kv_stats) 注册
+ */
+int proc_pid_kv_stats(struct seq_file *m, struct pid_namespace *ns,
+		      struct pid *pid, struct task_struct *task);
+void exit_kv_store(struct task_struct *tsk);
+void exec_kv_store(struct task_struct *tsk);
+int copy_kv_store(unsigned long clone_flags, struct task_struct *p);
+void kv_store_cache_init(void);
+struct kv_store *kv_store_get_or_create(void);
+struct kv_store *kv_store_alloc(unsigned int mode);
+struct kv_store *kv_ns_get_fd(int fd);
+void exit_kv_ns(struct ipc_namespace *ns);
+
+/* 以下接口对 NULL 表按空表处理（kv_set、kv_fetch_add 除外） */
+int kv_set(struct kv_store *kv, u64 key, const void *val, u32 len);
+int kv_get(struct kv_store *kv, u64 key, void *buf, u32 size, u32 *vlen);
+int kv_del(struct kv_store *kv, u64 key);
+int kv_fetch_add(struct kv_store *kv, u64 key, s64 delta, s64 *old);
+int kv_cas(struct kv_store *kv, u64 key, u64 expected, u64 desired,
+	   u64 *actual);
+int kv_expire(struct kv_store *kv, u64 key, unsigned int ttl_ms);
+
+struct page *kv_vindex_page(unsigned long pgoff);
+void vkv_reset(struct mm_struct *mm);
+
+/* kernel/kv_wbuf.c，KV_MODE_BUFFERED 的每线程写缓冲区 */
+bool kv_wbuf_put(struct kv_store *kv, u64 key, const void *val, u32 len);
+int kv_wbuf_get(struct kv_store *kv, u64 key, void *buf, u32 size, u32 *vlen);
+int kv_wbuf_flush_current(bool take_err);
+void exit_kv_wbuf(struct task_struct *tsk);
+
+#endif /* _LINUX_KV_STORE_H */
@@ -0,0 +1,57 @@
+#ifndef _LINUX_KV_VINDEX_H
+#define _LINUX_KV_VINDEX_H
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include <asm/page_types.h>
+
+/*
+ * KV 表的只读快照，以 [vkv] 特殊映射只读地映射给用户态，
+ * 由 vDSO 的 __vdso_read_kv() 直接查询，不进内核。
+ *
+ * 只收录 v1 接口能读到的条目（int 范围的键、4 字节的值）。
+ * 第 0 页是头部，后面是开放寻址（线性探测）的槽位数组。
+ * 内核修改时先把 seq 加成奇数、改完再加成偶数，读者前后两次读到
+ * 同一个偶数才算读到一致的结果。
+ *
+ * 这个头文件同时被内核和 vDSO 使用，只能依赖最基本的头文件。
+ */
+
+#define KV_VINDEX_BITS		12
+#define KV_VINDEX_SLOTS		(1U << KV_VINDEX_BITS)
+#define KV_VINDEX_MAX_USED	(KV_VINDEX_SLOTS / 4 * 3)	/* 装载因子上限 */
+#define KV_VINDEX_PAGES		17	/* 头部 1 页 + 槽位 16 页，与 VVAR_KV_NR_PAGES 一致 */
+#define KV_VINDEX_MAGIC		0x4b56494eU	/* "KVIN" */
+
+/* 快照不完整：未命中不能当作"不存在"，要回退到系统调用 */
+#define KV_VINDEX_POPULATING	(1U << 0)	/* 还在从表里灌数据 */
+#define KV_VINDEX_OVERFLOW	(1U << 1)	/* 槽位用满，之后的新键没有收录 */
+/* 命中也不可信，一律走系统调用（KV_MODE_BUFFERED 要读到本线程缓冲的写入） */
+#define KV_VINDEX_BYPASS	(1U << 2)
+#define KV_VINDEX_TTL		(1U << 3)	/* 带过期时间的条目没有收录 */
+
+struct kv_vindex_hdr {
+	u32 seq;
+	u32 magic;
+	u32 flags;
+	u32 nr_used;
+};
+
+struct kv_vslot {
+	s32 key;
+	s32 value;
+	u32 used;
+	u32 pad;
+};
+
+static __always_inline u32 kv_vindex_hash(s32 key)
+{
+	return ((u32)key * 0x9e3779b1U) >> (32 - KV_VINDEX_BITS);
+}
+
+static __always_inline struct kv_vslot *kv_vindex_slots(void *hdr)
+{
+	return (struct kv_vslot *)((char *)hdr + PAGE_SIZE);
+}
+
+#endif /* _LINUX_KV_VINDEX_H */
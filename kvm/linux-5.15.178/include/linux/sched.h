@@ -49,6 +49,8 @@ struct fs_struct;
 struct futex_pi_state;
 struct io_context;
 struct io_uring_task;
+struct kv_store;
+struct kv_wbuf;
 struct mempolicy;
 struct nameidata;
 struct nsproxy;
@@ -56,6 +58,7 @@ struct perf_event_context;
 struct pid_namespace;
 struct pipe_inode_info;
 struct rcu_node;
+struct sock_acct;
 struct reclaim_state;
 struct robust_list_head;
 struct root_domain;
@@ -735,14 +738,22 @@ struct task_struct {
 	 */
 	randomized_struct_fields_start
 
-	struct hlist_head *kv_store;
-	spinlock_t *kv_store_lock;
-	// struct hlist_head kv_store[1024];
-	// spinlock_t kv_store_lock[1024];
+	struct kv_store *kv_store;
+	struct kv_wbuf *kv_wbuf;	/* KV_MODE_BUFFERED：本线程的写缓冲区 */
 	/* 线程Socket限制相关字段 */
     int max_socket_allowed;   /* 该线程允许打开的最大socket数 */
-    int socket_count;         /* 当前线程打开的socket数量 */
+    struct sock_acct *sock_acct; /* 当前线程打开的socket数量，第一次创建时分配 */
     int priority_level;       /* 线程Socket优先级 */
+    unsigned int socket_attr_flags; /* SOCKET_ATTR_INHERIT */
+    /* 只由本线程在 net/socket.c 的收发路径上累加，不用原子操作 */
+    u64 sock_tx_bytes;
+    u64 sock_tx_msgs;
+    u64 sock_rx_bytes;
+    u64 sock_rx_msgs;
+    /* 发送限速，sock_rate 为 0 表示不限；sock_tat 见 kernel/sock_rate.c */
+    u64 sock_rate;            /* 字节/秒 */
+    u64 sock_burst;           /* 字节 */
+    atomic64_t sock_tat;
 	
 	void				*stack;
 	refcount_t			usage;
@@ -2,8 +2,80 @@
 #define _LINUX_SOCKET_ATTRS_H
 
 #include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/refcount.h>
 #include <uapi/linux/socket_attrs.h>
 
 long set_thread_socket_attrs(pid_t pid, int max_sockets, int priority_level, unsigned int flags);
 
+/*
+ * 线程名下还没关闭的 socket 计数。socket 可能在别的线程甚至别的进程里
+ * 关闭，也可能比创建它的线程活得久，所以计数放在单独带引用的对象里，
+ * socket 自己记着它记在谁名下。同一线程组的线程共享一个 group 汇总。
+ */
+struct sock_acct {
+	refcount_t ref;			/* 线程持有一个，名下每个 socket 各一个 */
+	atomic_t count;
+	struct sock_acct *group;	/* 线程组的汇总，自己就是汇总时为 NULL */
+};
+
+struct socket;
+struct sock;
+struct task_struct;
+struct sock_cg;
+
+/*
+ * sock_prio_map 上次给 socket 设的值。priority_level 变了重新设置时只改
+ * 还是这些值的字段，用户用 setsockopt() 自己改过的不动。pacing 上限
+ * 实际是 max_pacing_rate 和线程限速压上的 rate_cap 中小的那个。
+ */
+struct sock_prio_applied {
+	bool valid;			/* 为 false 时还没设过，以 socket 当前值为准 */
+	u8 tos;
+	u32 priority;
+	u32 mark;
+	unsigned long max_pacing_rate;
+	unsigned long rate_cap;		/* 0 表示没有 */
+};
+
+int sock_acct_charge(struct socket *sock);
+void sock_acct_uncharge(struct socket *sock);
+struct sock_acct *sock_acct_owner(struct socket *sock);
+struct sock_prio_applied *sock_acct_prio(struct socket *sock);
+int sock_acct_priority_level(struct socket *sock);
+int sock_acct_count(struct task_struct *task);
+int sock_acct_group_count(struct task_struct *task);
+void sock_acct_put(struct sock_acct *acct);
+
+/* kernel/sock_cgroup.c，按 cgroup 限制 socket 数 */
+#ifdef CONFIG_CGROUPS
+struct sock_cg *sock_cg_charge(void);
+void sock_cg_uncharge(struct sock_cg *cg);
+int sock_cg_priority_level(struct sock_cg *cg);
+#else
+static inline struct sock_cg *sock_cg_charge(void) { return NULL; }
+static inline void sock_cg_uncharge(struct sock_cg *cg) { }
+static inline int sock_cg_priority_level(struct sock_cg *cg) { return 0; }
+#endif
+
+/* kernel/sock_rate.c，每线程的发送限速 */
+int sock_rate_wait(struct socket *sock, size_t len, int flags);
+
+/* kernel/sock_prio_map.c，priority_level 到 socket 参数的映射 */
+#define SOCK_PRIO_UPDATE_LEVEL	0x01	/* priority_level 变了 */
+#define SOCK_PRIO_UPDATE_RATE	0x02	/* 发送限速变了 */
+
+#ifdef CONFIG_INET
+void sock_prio_map_apply(struct socket *sock, int level);
+void sock_prio_map_cap(struct socket *sock, unsigned long rate, bool lower);
+void sock_prio_map_update_task(struct task_struct *task, bool group,
+			       unsigned int what);
+#else
+static inline void sock_prio_map_apply(struct socket *sock, int level) { }
+static inline void sock_prio_map_cap(struct socket *sock, unsigned long rate,
+				     bool lower) { }
+static inline void sock_prio_map_update_task(struct task_struct *task,
+					     bool group, unsigned int what) { }
+#endif
+
 #endif /* _LINUX_SOCKET_ATTRS_H */
\ No newline at end of file
@@ -10,6 +10,10 @@
 #define _LINUX_SYSCALLS_H
 
 struct __aio_sigset;
+struct kv_batch_entry;
+struct kv_ring_params;
+struct kv_scan_entry;
+struct socket_attrs;
 struct epoll_event;
 struct iattr;
 struct inode;
@@ -792,6 +796,43 @@ asmlinkage long sys_sysinfo(struct sysinfo __user *info);
 /* kernel/kv_store.c */
 asmlinkage long sys_write_kv(int k, int v);
 asmlinkage long sys_read_kv(int k);
+asmlinkage long sys_write_kv_batch(struct kv_batch_entry __user *entries,
+				   unsigned int nr);
+asmlinkage long sys_read_kv_batch(struct kv_batch_entry __user *entries,
+				  unsigned int nr);
+asmlinkage long sys_kv_put(__u64 key, const void __user *val, __u32 len);
+asmlinkage long sys_kv_get(__u64 key, void __user *buf, __u32 len,
+			   __u32 __user *out_len);
+asmlinkage long sys_delete_kv(__u64 key);
+asmlinkage long sys_scan_kv(__s64 start, struct kv_scan_entry __user *buf,
+			    unsigned int n);
+asmlinkage long sys_kv_ctl(unsigned int cmd, unsigned long arg);
+asmlinkage long sys_kv_fetch_add(__u64 key, __s64 delta, __s64 __user *old);
+asmlinkage long sys_kv_cas(__u64 key, __u64 expected, __u64 desired,
+			   __u64 __user *actual);
+asmlinkage long sys_kv_dump(unsigned int fd);
+asmlinkage long sys_kv_load(unsigned int fd);
+asmlinkage long sys_kv_expire(__u64 key, __u32 ttl_ms);
+
+/* kernel/kv_ns.c */
+asmlinkage long sys_kv_ns_open(const char __user *name, int flags,
+			       umode_t mode);
+asmlinkage long sys_kv_ns_unlink(const char __user *name);
+
+/* kernel/set_thread_socket_attrs.c */
+asmlinkage long sys_set_thread_socket_attrs2(pid_t pid,
+				const struct socket_attrs __user *attrs,
+				size_t usize, unsigned int flags);
+
+/* kernel/sock_cgroup.c */
+asmlinkage long sys_set_cgroup_socket_attrs(int cgroup_fd, int max_sockets,
+					    int priority_level,
+					    unsigned int flags);
+
+/* kernel/kv_ring.c */
+asmlinkage long sys_kv_ring_setup(u32 entries,
+				  struct kv_ring_params __user *params);
+asmlinkage long sys_kv_ring_enter(unsigned int fd, u32 to_submit, u32 flags);
 
 
 /* ipc/mqueue.c */
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM kv_store
+
+#if !defined(_TRACE_KV_STORE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_KV_STORE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * 每次读写一条，lat_ns 是在表里花的时间（不含用户态拷贝）。
+ * 只有事件打开时才取时间戳。
+ */
+DECLARE_EVENT_CLASS(kv_op,
+
+	TP_PROTO(u64 key, u32 len, int ret, u64 lat_ns),
+
+	TP_ARGS(key, len, ret, lat_ns),
+
+	TP_STRUCT__entry(
+		__field(u64,	key)
+		__field(u32,	len)
+		__field(int,	ret)
+		__field(u64,	lat_ns)
+	),
+
+	TP_fast_assign(
+		__entry->key	= key;
+		__entry->len	= len;
+		__entry->ret	= ret;
+		__entry->lat_ns	= lat_ns;
+	),
+
+	TP_printk("key=%lld len=%u ret=%d lat=%lluns",
+		  (s64)__entry->key, __entry->len, __entry->ret,
+		  __entry->lat_ns)
+);
+
+DEFINE_EVENT(kv_op, kv_write,
+	TP_PROTO(u64 key, u32 len, int ret, u64 lat_ns),
+	TP_ARGS(key, len, ret, lat_ns)
+);
+
+DEFINE_EVENT(kv_op, kv_read,
+	TP_PROTO(u64 key, u32 len, int ret, u64 lat_ns),
+	TP_ARGS(key, len, ret, lat_ns)
+);
+
+#endif /* _TRACE_KV_STORE_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -888,8 +888,45 @@ __SYSCALL(__NR_read_kv, sys_read_kv)
 #define __NR_set_thread_socket_attrs 451
 __SYSCALL(__NR_set_thread_socket_attrs, sys_set_thread_socket_attrs)
 
+#define __NR_write_kv_batch 452
+__SYSCALL(__NR_write_kv_batch, sys_write_kv_batch)
+#define __NR_read_kv_batch 453
+__SYSCALL(__NR_read_kv_batch, sys_read_kv_batch)
+#define __NR_kv_put 454
+__SYSCALL(__NR_kv_put, sys_kv_put)
+#define __NR_kv_get 455
+__SYSCALL(__NR_kv_get, sys_kv_get)
+#define __NR_kv_ring_setup 456
+__SYSCALL(__NR_kv_ring_setup, sys_kv_ring_setup)
+#define __NR_kv_ring_enter 457
+__SYSCALL(__NR_kv_ring_enter, sys_kv_ring_enter)
+#define __NR_delete_kv 458
+__SYSCALL(__NR_delete_kv, sys_delete_kv)
+#define __NR_scan_kv 459
+__SYSCALL(__NR_scan_kv, sys_scan_kv)
+#define __NR_kv_ctl 460
+__SYSCALL(__NR_kv_ctl, sys_kv_ctl)
+#define __NR_kv_fetch_add 461
+__SYSCALL(__NR_kv_fetch_add, sys_kv_fetch_add)
+#define __NR_kv_cas 462
+__SYSCALL(__NR_kv_cas, sys_kv_cas)
+#define __NR_kv_dump 463
+__SYSCALL(__NR_kv_dump, sys_kv_dump)
+#define __NR_kv_load 464
+__SYSCALL(__NR_kv_load, sys_kv_load)
+#define __NR_kv_ns_open 465
+__SYSCALL(__NR_kv_ns_open, sys_kv_ns_open)
+#define __NR_kv_ns_unlink 466
+__SYSCALL(__NR_kv_ns_unlink, sys_kv_ns_unlink)
+#define __NR_kv_expire 467
+__SYSCALL(__NR_kv_expire, sys_kv_expire)
+#define __NR_set_cgroup_socket_attrs 468
+__SYSCALL(__NR_set_cgroup_socket_attrs, sys_set_cgroup_socket_attrs)
+#define __NR_set_thread_socket_attrs2 469
+__SYSCALL(__NR_set_thread_socket_attrs2, sys_set_thread_socket_attrs2)
+
 #undef __NR_syscalls
-#define __NR_syscalls 452
+#define __NR_syscalls 470
 
 /*
  * 32 bit systems traditionally used different
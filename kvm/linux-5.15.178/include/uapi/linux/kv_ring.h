@@ -0,0 +1,108 @@
+#ifndef _UAPI_LINUX_KV_RING_H
+#define _UAPI_LINUX_KV_RING_H
+
+#include <linux/types.h>
+
+/*
+ * KV 提交/完成环，仿照 io_uring。kv_ring_setup() 返回一个 fd，对它
+ * mmap(offset 0, sq_off/cq_off 给出的总长度) 得到共享区域：
+ *
+ *   用户态写 sqe、推进 sq.tail；内核消费后推进 sq.head。
+ *   内核写 cqe、推进 cq.tail；用户态读完后推进 cq.head。
+ *
+ * head/tail 都是单调递增的计数，取模 ring_mask 得到下标。
+ */
+
+/* 操作码 */
+#define KV_OP_NOP	0
+#define KV_OP_WRITE	1	/* 把 addr 处 len 字节写到 key */
+#define KV_OP_READ	2	/* 把 key 的值读到 addr 处，缓冲区 len 字节 */
+#define KV_OP_DELETE	3	/* 删除 key */
+
+/**
+ * struct kv_ring_sqe - 一条提交记录
+ * @opcode: KV_OP_*
+ * @flags: 保留，必须为 0
+ * @len: 值或缓冲区的长度
+ * @key: 64 位键
+ * @addr: 用户态缓冲区地址
+ * @user_data: 原样带回到对应的 cqe
+ */
+struct kv_ring_sqe {
+	__u8	opcode;
+	__u8	flags;
+	__u16	resv;
+	__u32	len;
+	__u64	key;
+	__u64	addr;
+	__u64	user_data;
+};
+
+/**
+ * struct kv_ring_cqe - 一条完成记录
+ * @user_data: 来自 sqe
+ * @res: 0 或负的错误码，语义同 kv_put/kv_get
+ * @len: KV_OP_READ 时为值的实际长度
+ */
+struct kv_ring_cqe {
+	__u64	user_data;
+	__s32	res;
+	__u32	len;
+};
+
+struct kv_sqring_offsets {
+	__u32	head;
+	__u32	tail;
+	__u32	ring_mask;
+	__u32	ring_entries;
+	__u32	flags;
+	__u32	sqes;
+	__u32	resv[2];
+};
+
+/* sq.flags，内核写 */
+#define KV_SQ_NEED_WAKEUP	(1U << 0)	/* 轮询线程已睡眠，需要 KV_RING_ENTER_SQ_WAKEUP */
+
+/* cq.overflow：完成环满、提交因此暂停的次数 */
+struct kv_cqring_offsets {
+	__u32	head;
+	__u32	tail;
+	__u32	ring_mask;
+	__u32	ring_entries;
+	__u32	overflow;
+	__u32	cqes;
+	__u32	resv[2];
+};
+
+/* kv_ring_params.flags */
+#define KV_RING_SETUP_SQPOLL	(1U << 0)	/* 由内核线程轮询提交环 */
+#define KV_RING_SETUP_NS	(1U << 1)	/* 绑定到 ns_fd 指定的命名表 */
+
+/**
+ * struct kv_ring_params - kv_ring_setup 的参数
+ * @sq_entries: 内核填入，提交环大小（向上取到 2 的幂）
+ * @cq_entries: 内核填入，完成环大小，为 sq_entries 的两倍
+ * @flags: KV_RING_SETUP_*
+ * @sq_thread_idle: SQPOLL 时轮询线程空转多少毫秒后睡眠，0 取默认值
+ * @sq_off, @cq_off: 内核填入，各字段在映射区域内的偏移
+ * @ring_size: 内核填入，mmap 的长度
+ * @ns_fd: KV_RING_SETUP_NS 时为 kv_ns_open() 返回的 fd
+ */
+struct kv_ring_params {
+	__u32	sq_entries;
+	__u32	cq_entries;
+	__u32	flags;
+	__u32	sq_thread_idle;
+	__u32	ring_size;
+	__s32	ns_fd;
+	__u32	resv[2];
+	struct kv_sqring_offsets sq_off;
+	struct kv_cqring_offsets cq_off;
+};
+
+/* kv_ring_enter 的 flags */
+#define KV_RING_ENTER_SQ_WAKEUP	(1U << 0)
+
+#define KV_RING_MAX_ENTRIES	4096
+
+#endif /* _UAPI_LINUX_KV_RING_H */
@@ -0,0 +1,79 @@
+#ifndef _UAPI_LINUX_KV_STORE_H
+#define _UAPI_LINUX_KV_STORE_H
+
+#include <linux/types.h>
+
+/**
+ * struct kv_batch_entry - write_kv_batch/read_kv_batch 的一条记录
+ * @key: 键
+ * @value: write 时为输入；read 命中时由内核填入
+ * @status: 内核填入，0 表示成功，否则为负的错误码
+ *          (read 未命中为 -ENOENT，write 分配失败为 -ENOMEM)
+ */
+struct kv_batch_entry {
+	__s32 key;
+	__s32 value;
+	__s32 status;
+};
+
+/* kv_put/kv_get 单个值的最大字节数 */
+#define KV_VALUE_MAX	4096
+
+/**
+ * struct kv_scan_entry - scan_kv 返回的一条记录
+ * @key: 键
+ * @value: 值不超过 8 字节时为值本身（按小端放在低位），否则为 0
+ * @len: 值的长度
+ */
+struct kv_scan_entry {
+	__u64 key;
+	__u64 value;
+	__u32 len;
+	__u32 resv;
+};
+
+/* scan_kv 每次最多返回的条数 */
+#define KV_SCAN_MAX	256
+
+/*
+ * kv_dump/kv_load 的文件格式，整数都是小端：
+ *
+ *   struct kv_dump_hdr
+ *   若干条 { struct kv_dump_rec; __u8 value[len]; }
+ *   结束记录 struct kv_dump_rec，len 为 KV_DUMP_END，key 为记录条数
+ *   __le32 校验和：从头部到结束记录的 crc32（crc32_le，初值 0）
+ */
+#define KV_DUMP_MAGIC		0x4b564450U	/* "KVDP" */
+#define KV_DUMP_VERSION		1
+#define KV_DUMP_END		0xffffffffU
+
+struct kv_dump_hdr {
+	__le32 magic;
+	__le32 version;
+};
+
+struct kv_dump_rec {
+	__le64 key;
+	__le32 len;
+} __attribute__((packed));
+
+/* kv_ctl 命令 */
+#define KV_CTL_SET_MODE		1	/* arg 为 KV_MODE_*，只能在表创建前设置 */
+#define KV_CTL_GET_MODE		2
+#define KV_CTL_FLUSH		3	/* 把本线程缓冲的写入刷进表，返回其间的第一个错误 */
+#define KV_CTL_ATTACH		4	/* arg 为 kv_ns_open() 的 fd，只能在表创建前设置 */
+#define KV_CTL_SET_TTL		5	/* arg 为之后写入的条目的默认 TTL（毫秒），0 表示不过期 */
+#define KV_CTL_SET_CAPACITY	6	/* arg 为条目数上限，超过时按 CLOCK 近似 LRU 淘汰，0 表示不限制 */
+
+/* kv_ns_open 的名字最长字节数（含结尾的 0） */
+#define KV_NS_NAME_MAX		64
+
+/* 表的模式 */
+#define KV_MODE_ORDERED		(1U << 0)	/* 维护有序索引，scan_kv 不用遍历全表 */
+#define KV_MODE_INHERIT		(1U << 1)	/* fork 出的子进程以写时复制方式继承整张表，不能与 ORDERED 同用 */
+#define KV_MODE_BUFFERED	(1U << 2)	/* 写入先进每线程的缓冲区，本线程读得到，其它线程稍后可见 */
+#define KV_MODE_EVENTUAL	(1U << 3)	/* 与 BUFFERED 同用：本线程读也不查缓冲区 */
+#define KV_MODE_MASK		(KV_MODE_ORDERED | KV_MODE_INHERIT | \
+				 KV_MODE_BUFFERED | KV_MODE_EVENTUAL)
+
+#endif /* _UAPI_LINUX_KV_STORE_H */
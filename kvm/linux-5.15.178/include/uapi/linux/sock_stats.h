@@ -0,0 +1,35 @@
+#ifndef _UAPI_LINUX_SOCK_STATS_H
+#define _UAPI_LINUX_SOCK_STATS_H
+
+/*
+ * 每个线程通过 socket 收发的字节数和消息数，generic netlink 接口。消息
+ * 数是成功的收发调用次数，不是网卡上的包数。
+ * 对 SOCK_STATS_CMD_GET 发 NLM_F_DUMP 请求，每个线程回一条消息；
+ * 请求里带 SOCK_STATS_ATTR_TGID 时只回这个进程的线程。
+ * 同样的计数也在 /proc/<pid>/task/<tid>/status 里。
+ */
+
+#define SOCK_STATS_GENL_NAME	"sock_stats"
+#define SOCK_STATS_GENL_VERSION	1
+
+enum {
+	SOCK_STATS_CMD_UNSPEC,
+	SOCK_STATS_CMD_GET,
+	__SOCK_STATS_CMD_MAX,
+};
+#define SOCK_STATS_CMD_MAX (__SOCK_STATS_CMD_MAX - 1)
+
+enum {
+	SOCK_STATS_ATTR_UNSPEC,
+	SOCK_STATS_ATTR_PAD,
+	SOCK_STATS_ATTR_TID,		/* u32 */
+	SOCK_STATS_ATTR_TGID,		/* u32 */
+	SOCK_STATS_ATTR_TX_BYTES,	/* u64 */
+	SOCK_STATS_ATTR_TX_MSGS,	/* u64 */
+	SOCK_STATS_ATTR_RX_BYTES,	/* u64 */
+	SOCK_STATS_ATTR_RX_MSGS,	/* u64 */
+	__SOCK_STATS_ATTR_MAX,
+};
+#define SOCK_STATS_ATTR_MAX (__SOCK_STATS_ATTR_MAX - 1)
+
+#endif /* _UAPI_LINUX_SOCK_STATS_H */
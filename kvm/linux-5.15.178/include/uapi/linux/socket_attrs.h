@@ -1,8 +1,34 @@
 #ifndef _UAPI_LINUX_SOCKET_ATTRS_H
 #define _UAPI_LINUX_SOCKET_ATTRS_H
 
+#include <linux/types.h>
+
 /* 系统调用标志 */
 #define SOCKET_ATTR_NONE      0x00
 #define SOCKET_ATTR_RECURSIVE 0x01  /* 影响所有子线程 */
+#define SOCKET_ATTR_INHERIT   0x02  /* 之后创建的线程和子进程沿用这组设置 */
+
+#define SOCKET_ATTR_ALL       (SOCKET_ATTR_RECURSIVE | SOCKET_ATTR_INHERIT)
+
+/* socket_attrs.rate 取这个值表示不改限速设置 */
+#define SOCKET_ATTR_RATE_KEEP ((__u64)-1)
+
+/**
+ * struct socket_attrs - set_thread_socket_attrs2() 的参数
+ * @max_sockets: 最大 socket 数，-1 表示不限制，小于 -1 表示不改
+ * @priority_level: 0~100，之外的值表示不改
+ * @rate: 发送限速，字节/秒，0 表示不限速，SOCKET_ATTR_RATE_KEEP 表示不改
+ * @burst: 允许的突发字节数，0 取默认值；@rate 不改时忽略
+ *
+ * 以后只在末尾加字段，内核按传入的大小兼容新旧结构。
+ */
+struct socket_attrs {
+	__s32 max_sockets;
+	__s32 priority_level;
+	__u64 rate;
+	__u64 burst;
+};
+
+#define SOCKET_ATTRS_SIZE_VER0 24 /* 第一版结构的大小 */
 
 #endif /* _UAPI_LINUX_SOCKET_ATTRS_H */
\ No newline at end of file
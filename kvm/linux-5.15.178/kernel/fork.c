@@ -97,6 +97,8 @@
 #include <linux/scs.h>
 #include <linux/io_uring.h>
 #include <linux/bpf.h>
+#include <linux/kv_store.h>
+#include <linux/socket_attrs.h>
 #include <linux/tick.h>
 
 #include <asm/pgalloc.h>
@@ -468,6 +470,10 @@ void free_task(struct task_struct *tsk)
 #endif
 	rt_mutex_debug_task_free(tsk);
 	ftrace_graph_exit_task(tsk);
+	/* 线程组还没退完时组长不会被释放；exec 时被替换的旧组长走这里 */
+	kv_store_put(tsk->kv_store);
+	/* 名下的 socket 还各自持有引用，关闭时才真正释放 */
+	sock_acct_put(tsk->sock_acct);
 	arch_release_task_struct(tsk);
 	if (tsk->flags & PF_KTHREAD)
 		free_kthread_struct(tsk);
@@ -1430,12 +1436,15 @@ void exit_mm_release(struct task_struct *tsk, struct mm_struct *mm)
 {
 	futex_exit_release(tsk);
 	mm_release(tsk, mm);
+	exit_kv_wbuf(tsk);
+	exit_kv_store(tsk);
 }
 
 void exec_mm_release(struct task_struct *tsk, struct mm_struct *mm)
 {
 	futex_exec_release(tsk);
 	mm_release(tsk, mm);
+	exec_kv_store(tsk);
 }
 
 /**
@@ -1697,6 +1706,30 @@ static int copy_signal(unsigned long clone_flags, struct task_struct *tsk)
 	return 0;
 }
 
+/*
+ * 设置过 SOCKET_ATTR_INHERIT 时沿用创建者的 socket 属性，否则恢复默认值。
+ * 在 siglock 下从 current 重新取，SOCKET_ATTR_RECURSIVE 遍历线程组时
+ * 也拿着它：dup_task_struct() 之后、挂上线程链表之前被改掉的值不会漏。
+ */
+static void copy_socket_attrs(struct task_struct *p)
+{
+	assert_spin_locked(&current->sighand->siglock);
+
+	if (current->socket_attr_flags & SOCKET_ATTR_INHERIT) {
+		p->max_socket_allowed = current->max_socket_allowed;
+		p->priority_level = current->priority_level;
+		p->sock_rate = current->sock_rate;
+		p->sock_burst = current->sock_burst;
+		p->socket_attr_flags = current->socket_attr_flags;
+	} else {
+		p->max_socket_allowed = 0;     /* 默认不限制 */
+		p->priority_level = 0;         /* 默认优先级 */
+		p->sock_rate = 0;              /* 默认不限速 */
+		p->sock_burst = 0;
+		p->socket_attr_flags = 0;
+	}
+}
+
 static void copy_seccomp(struct task_struct *p)
 {
 #ifdef CONFIG_SECCOMP
@@ -2067,9 +2100,18 @@ static __latent_entropy struct task_struct *copy_process(
 #ifdef CONFIG_PROVE_LOCKING
 	DEBUG_LOCKS_WARN_ON(!p->softirqs_enabled);
 #endif
-	p->max_socket_allowed = 0;     /* 默认不限制 */
-    p->socket_count = 0;           /* 初始化为0 */
-    p->priority_level = 0;         /* 默认优先级 */
+	p->kv_store = NULL;            /* 第一次 write_kv 时才分配，线程用组长的表 */
+	p->kv_wbuf = NULL;
+	/* max_socket_allowed 等在 siglock 下由 copy_socket_attrs() 设置 */
+	atomic64_set(&p->sock_tat, 0);
+	p->sock_acct = NULL;           /* 第一次创建socket时才分配 */
+	p->sock_tx_bytes = p->sock_tx_msgs = 0;
+	p->sock_rx_bytes = p->sock_rx_msgs = 0;
+
+	/* KV_MODE_INHERIT：子进程写时复制地继承父进程的表 */
+	retval = copy_kv_store(clone_flags, p);
+	if (retval)
+		goto bad_fork_free;
 
 	retval = copy_creds(p, clone_flags);
 	if (retval < 0)
@@ -2290,24 +2332,6 @@ static __latent_entropy struct task_struct *copy_process(
 		p->tgid = p->pid;
 	}
 
-	if (clone_flags & CLONE_THREAD) { /* new thread */
-		p->kv_store = current->kv_store;
-		p->kv_store_lock = current->kv_store_lock;
-	} else { /* new process */
-		int i;
-    	p->kv_store = kmalloc(1024 * sizeof(struct hlist_head), GFP_KERNEL);
-    	p->kv_store_lock = kmalloc(1024 * sizeof(spinlock_t), GFP_KERNEL);
-    	if (!p->kv_store || !p->kv_store_lock) {
-    	    pr_err("Failed to allocate memory for KV store\n");
-    	    return ERR_PTR(-ENOMEM);
-    	}
-
-    	for (i = 0; i < 1024; i++) {
-    	    spin_lock_init(&p->kv_store_lock[i]);
-    	    INIT_HLIST_HEAD(&p->kv_store[i]);
-    	}
-	}
-
 	p->nr_dirtied = 0;
 	p->nr_dirtied_pause = 128 >> (PAGE_SHIFT - 10);
 	p->dirty_paused_when = 0;
@@ -2400,6 +2424,7 @@ static __latent_entropy struct task_struct *copy_process(
 	 * before holding sighand lock.
 	 */
 	copy_seccomp(p);
+	copy_socket_attrs(p);
 
 	init_task_pid_links(p);
 	if (likely(p->pid)) {
@@ -2988,6 +3013,7 @@ void __init proc_caches_init(void)
 	vm_area_cachep = KMEM_CACHE(vm_area_struct, SLAB_PANIC|SLAB_ACCOUNT);
 	mmap_init();
 	nsproxy_cache_init();
+	kv_store_cache_init();
 }
 
 /*
@@ -0,0 +1,337 @@
+#include <linux/syscalls.h>
+#include <linux/sched.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/anon_inodes.h>
+#include <linux/capability.h>
+#include <linux/cred.h>
+#include <linux/user_namespace.h>
+#include <linux/uidgid.h>
+#include <linux/xarray.h>
+#include <linux/sysctl.h>
+#include <linux/nsproxy.h>
+#include <linux/ipc_namespace.h>
+#include <linux/kv_store.h>
+
+/*
+ * 命名的 KV 表，用法仿照 POSIX shm：kv_ns_open() 按名字打开或创建，
+ * 得到一个持有表引用的 fd；kv_ctl(KV_CTL_ATTACH, fd) 把它设成调用者
+ * 线程组的表，之后所有 KV 系统调用都作用在这张共享的表上；
+ * kv_ring_setup() 也可以用 KV_RING_SETUP_NS 直接绑定到它。
+ *
+ * 名字本身持有一个引用，kv_ns_unlink() 之后表在最后一个使用者放手时
+ * 才释放。表的内部结构与进程私有的表完全相同。
+ *
+ * 名字和 POSIX shm 一样按 ipc 命名空间隔开：每个用过 kv_ns 的 ipc 命名
+ * 空间有一个 kv_ns_space，里面最后一个名字删掉时一起释放。它不持有
+ * 命名空间的引用，命名空间释放时 exit_kv_ns() 把剩下的名字全部删掉。
+ * 权限检查里的特权也按命名空间所属的用户命名空间算。每个用户（不分
+ * 命名空间）最多建 kv_ns_max 个名字，CAP_SYS_RESOURCE 不受限制。
+ */
+
+struct kv_ns_space {
+	struct list_head node;
+	struct ipc_namespace *ipc_ns;	/* 不持有引用，见 exit_kv_ns() */
+	struct list_head names;
+};
+
+struct kv_ns {
+	struct list_head node;
+	struct kv_store *kv;		/* 持有引用 */
+	kuid_t uid;
+	kgid_t gid;
+	umode_t mode;
+	char name[KV_NS_NAME_MAX];
+};
+
+static LIST_HEAD(kv_ns_spaces);
+static DEFINE_MUTEX(kv_ns_lock);	/* 保护以上全部和 kv_ns_users */
+
+/* 每个 uid 建了几个名字，xa_mk_value() 存的计数 */
+static DEFINE_XARRAY(kv_ns_users);
+
+static int sysctl_kv_ns_max __read_mostly = 256;
+
+static struct ctl_table kv_ns_sysctl_table[] = {
+	{
+		.procname	= "kv_ns_max",
+		.data		= &sysctl_kv_ns_max,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	},
+	{ }
+};
+
+static int __init kv_ns_sysctl_init(void)
+{
+	register_sysctl("kernel", kv_ns_sysctl_table);
+	return 0;
+}
+core_initcall(kv_ns_sysctl_init);
+
+static const struct file_operations kv_ns_fops;
+
+/* 调用者持有 kv_ns_lock。当前 ipc 命名空间的名字表，没有时 @create 就建 */
+static struct kv_ns_space *kv_ns_space(bool create)
+{
+	struct ipc_namespace *ipc_ns = current->nsproxy->ipc_ns;
+	struct kv_ns_space *sp;
+
+	list_for_each_entry(sp, &kv_ns_spaces, node)
+		if (sp->ipc_ns == ipc_ns)
+			return sp;
+	if (!create)
+		return NULL;
+	sp = kzalloc(sizeof(*sp), GFP_KERNEL_ACCOUNT);
+	if (!sp)
+		return NULL;
+	sp->ipc_ns = ipc_ns;
+	INIT_LIST_HEAD(&sp->names);
+	list_add(&sp->node, &kv_ns_spaces);
+	return sp;
+}
+
+/* 调用者持有 kv_ns_lock */
+static void kv_ns_space_put(struct kv_ns_space *sp)
+{
+	if (!list_empty(&sp->names))
+		return;
+	list_del(&sp->node);
+	kfree(sp);
+}
+
+/* 调用者持有 kv_ns_lock */
+static struct kv_ns *kv_ns_find(struct kv_ns_space *sp, const char *name)
+{
+	struct kv_ns *ns;
+
+	if (!sp)
+		return NULL;
+	list_for_each_entry(ns, &sp->names, node)
+		if (!strcmp(ns->name, name))
+			return ns;
+	return NULL;
+}
+
+/* 调用者持有 kv_ns_lock。给 @uid 记上一个名字，超过上限返回 -ENOSPC */
+static int kv_ns_charge(kuid_t uid)
+{
+	void *old = xa_load(&kv_ns_users, __kuid_val(uid));
+	unsigned long n = old ? xa_to_value(old) : 0;
+
+	if (n >= READ_ONCE(sysctl_kv_ns_max) && !capable(CAP_SYS_RESOURCE))
+		return -ENOSPC;
+	return xa_err(xa_store(&kv_ns_users, __kuid_val(uid),
+			       xa_mk_value(n + 1), GFP_KERNEL));
+}
+
+/* 调用者持有 kv_ns_lock */
+static void kv_ns_uncharge(kuid_t uid)
+{
+	unsigned long n = xa_to_value(xa_load(&kv_ns_users, __kuid_val(uid)));
+
+	if (n > 1)
+		xa_store(&kv_ns_users, __kuid_val(uid), xa_mk_value(n - 1),
+			 GFP_KERNEL);
+	else
+		xa_erase(&kv_ns_users, __kuid_val(uid));
+}
+
+/* 同 ipcperms()：属主、属组、其他人三组权限位，要求可读写 */
+static bool kv_ns_permitted(const struct kv_ns_space *sp,
+			    const struct kv_ns *ns)
+{
+	umode_t granted = ns->mode;
+
+	if (uid_eq(current_euid(), ns->uid))
+		granted >>= 6;
+	else if (in_group_p(ns->gid))
+		granted >>= 3;
+	if ((granted & 6) == 6)
+		return true;
+	return ns_capable(sp->ipc_ns->user_ns, CAP_IPC_OWNER);
+}
+
+static bool kv_ns_owner(const struct kv_ns_space *sp, const struct kv_ns *ns)
+{
+	return uid_eq(current_euid(), ns->uid) ||
+	       ns_capable(sp->ipc_ns->user_ns, CAP_SYS_ADMIN);
+}
+
+/* 调用者持有 kv_ns_lock。删掉名字，表在最后一个使用者放手时释放 */
+static void kv_ns_destroy(struct kv_ns *ns)
+{
+	list_del(&ns->node);
+	kv_ns_uncharge(ns->uid);
+	kv_store_put(ns->kv);
+	kfree(ns);
+}
+
+/*
+ * ipc 命名空间释放时由 free_ipc_ns() 调用，删掉其中剩下的名字。已经
+ * 打开或挂上的表不受影响。
+ */
+void exit_kv_ns(struct ipc_namespace *ipc_ns)
+{
+	struct kv_ns_space *sp;
+	struct kv_ns *ns, *tmp;
+
+	mutex_lock(&kv_ns_lock);
+	list_for_each_entry(sp, &kv_ns_spaces, node) {
+		if (sp->ipc_ns != ipc_ns)
+			continue;
+		list_for_each_entry_safe(ns, tmp, &sp->names, node)
+			kv_ns_destroy(ns);
+		kv_ns_space_put(sp);
+		break;
+	}
+	mutex_unlock(&kv_ns_lock);
+}
+
+static int kv_ns_release(struct inode *inode, struct file *file)
+{
+	kv_store_put(file->private_data);
+	return 0;
+}
+
+static const struct file_operations kv_ns_fops = {
+	.release	= kv_ns_release,
+};
+
+/* 取 @fd 对应的命名表并持有引用 */
+struct kv_store *kv_ns_get_fd(int fd)
+{
+	struct kv_store *kv;
+	struct fd f = fdget(fd);
+
+	if (!f.file)
+		return ERR_PTR(-EBADF);
+	kv = ERR_PTR(-EINVAL);
+	if (f.file->f_op == &kv_ns_fops) {
+		kv = f.file->private_data;
+		kv_store_get(kv);
+	}
+	fdput(f);
+	return kv;
+}
+
+static int kv_ns_getname(char *name, const char __user *uname)
+{
+	long len = strncpy_from_user(name, uname, KV_NS_NAME_MAX);
+
+	if (len < 0)
+		return len;
+	if (!len)
+		return -EINVAL;
+	if (len == KV_NS_NAME_MAX)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/*
+ * @flags 只认 O_CREAT、O_EXCL 和 O_CLOEXEC，语义同 open()；新建时
+ * @mode 的低 9 位是权限。返回一个 fd。
+ */
+SYSCALL_DEFINE3(kv_ns_open, const char __user *, uname, int, flags,
+		umode_t, mode)
+{
+	char name[KV_NS_NAME_MAX];
+	struct kv_ns_space *sp;
+	struct kv_store *kv;
+	struct kv_ns *ns;
+	int fd;
+
+	if (flags & ~(O_CREAT | O_EXCL | O_CLOEXEC))
+		return -EINVAL;
+	fd = kv_ns_getname(name, uname);
+	if (fd)
+		return fd;
+
+	mutex_lock(&kv_ns_lock);
+	sp = kv_ns_space(flags & O_CREAT);
+	ns = kv_ns_find(sp, name);
+	if (ns) {
+		fd = -EEXIST;
+		if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+			goto out;
+		fd = -EACCES;
+		if (!kv_ns_permitted(sp, ns))
+			goto out;
+	} else {
+		fd = -ENOENT;
+		if (!(flags & O_CREAT))
+			goto out;
+		fd = -ENOMEM;
+		if (!sp)
+			goto out;
+		fd = kv_ns_charge(current_euid());
+		if (fd)
+			goto out_space;
+		fd = -ENOMEM;
+		ns = kzalloc(sizeof(*ns), GFP_KERNEL_ACCOUNT);
+		if (!ns)
+			goto out_uncharge;
+		ns->kv = kv_store_alloc(0);
+		if (!ns->kv) {
+			kfree(ns);
+			goto out_uncharge;
+		}
+		strscpy(ns->name, name, sizeof(ns->name));
+		ns->uid = current_euid();
+		ns->gid = current_egid();
+		ns->mode = mode & 0777;
+		list_add(&ns->node, &sp->names);
+	}
+	kv = ns->kv;
+	kv_store_get(kv);
+	fd = anon_inode_getfd("[kv_ns]", &kv_ns_fops, kv,
+			      O_RDWR | (flags & O_CLOEXEC));
+	if (fd < 0)
+		kv_store_put(kv);
+	goto out;
+out_uncharge:
+	kv_ns_uncharge(current_euid());
+out_space:
+	kv_ns_space_put(sp);
+out:
+	mutex_unlock(&kv_ns_lock);
+	return fd;
+}
+
+/* 删除名字，已经打开或挂上的使用者不受影响。只有属主能删 */
+SYSCALL_DEFINE1(kv_ns_unlink, const char __user *, uname)
+{
+	char name[KV_NS_NAME_MAX];
+	struct kv_ns_space *sp;
+	struct kv_ns *ns;
+	int ret;
+
+	ret = kv_ns_getname(name, uname);
+	if (ret)
+		return ret;
+
+	mutex_lock(&kv_ns_lock);
+	sp = kv_ns_space(false);
+	ns = kv_ns_find(sp, name);
+	ret = -ENOENT;
+	if (!ns)
+		goto out;
+	ret = -EPERM;
+	if (!kv_ns_owner(sp, ns))
+		goto out;
+	kv_ns_destroy(ns);
+	kv_ns_space_put(sp);
+	ret = 0;
+out:
+	mutex_unlock(&kv_ns_lock);
+	return ret;
+}
@@ -0,0 +1,454 @@
+#include <linux/syscalls.h>
+#include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/uaccess.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/file.h>
+#include <linux/anon_inodes.h>
+#include <linux/kthread.h>
+#include <linux/memcontrol.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+#include <linux/kv_store.h>
+#include <uapi/linux/kv_ring.h>
+
+/*
+ * KV 提交/完成环：用户态把操作写进共享内存里的提交环，内核要么在
+ * kv_ring_enter() 里、要么由轮询线程消费，结果写进完成环。
+ * 读操作的值直接拷进 sqe 指定的用户缓冲区。
+ */
+
+/* 映射区域的头部，head/tail 分在不同的缓存行，避免生产者和消费者互相踩 */
+struct kv_ring_hdr {
+	u32 sq_head ____cacheline_aligned_in_smp;
+	u32 sq_tail ____cacheline_aligned_in_smp;
+	u32 sq_flags;
+	u32 cq_head ____cacheline_aligned_in_smp;
+	u32 cq_tail ____cacheline_aligned_in_smp;
+	u32 cq_overflow;
+	u32 sq_ring_mask, sq_ring_entries;
+	u32 cq_ring_mask, cq_ring_entries;
+};
+
+struct kv_ring {
+	struct kv_ring_hdr *hdr;	/* vmalloc_user，整块映射给用户态 */
+	struct kv_ring_sqe *sqes;
+	struct kv_ring_cqe *cqes;
+	size_t size;
+
+	u32 sq_head;			/* 内核私有的副本，用户态改了 hdr 也不受影响 */
+	u32 cq_tail;
+	u32 sq_entries, cq_entries;
+
+	struct kv_store *kv;		/* 创建时所在线程组的表，持有一个引用 */
+	struct mm_struct *mm;		/* sqe 里的地址属于这个 mm */
+	struct mem_cgroup *memcg;	/* 轮询线程分配的条目记到这里 */
+
+	struct mutex lock;		/* 串行化对提交环的消费 */
+	void *buf;			/* KV_VALUE_MAX 字节，在 lock 下使用 */
+	wait_queue_head_t cq_wait;	/* poll() */
+
+	struct task_struct *sq_thread;
+	wait_queue_head_t sq_wait;
+	unsigned long sq_idle;		/* jiffies */
+};
+
+static const struct file_operations kv_ring_fops;
+
+static int kv_ring_issue(struct kv_ring *ring, const struct kv_ring_sqe *sqe,
+			 u32 *vlen)
+{
+	void __user *uaddr = u64_to_user_ptr(sqe->addr);
+	u32 size;
+	int ret;
+
+	if (sqe->flags || sqe->resv)
+		return -EINVAL;
+
+	switch (sqe->opcode) {
+	case KV_OP_NOP:
+		return 0;
+	case KV_OP_WRITE:
+		if (sqe->len > KV_VALUE_MAX)
+			return -E2BIG;
+		if (copy_from_user(ring->buf, uaddr, sqe->len))
+			return -EFAULT;
+		return kv_set(ring->kv, sqe->key, ring->buf, sqe->len);
+	case KV_OP_READ:
+		size = min_t(u32, sqe->len, KV_VALUE_MAX);
+		ret = kv_get(ring->kv, sqe->key, ring->buf, size, vlen);
+		if (!ret && copy_to_user(uaddr, ring->buf, *vlen))
+			ret = -EFAULT;
+		return ret;
+	case KV_OP_DELETE:
+		return kv_del(ring->kv, sqe->key);
+	default:
+		return -EINVAL;
+	}
+}
+
+static bool kv_ring_sq_pending(struct kv_ring *ring)
+{
+	return READ_ONCE(ring->hdr->sq_tail) != ring->sq_head;
+}
+
+/*
+ * 消费最多 @to_submit 条 sqe，返回实际消费的条数。完成环满时停下，
+ * 剩下的 sqe 留在环里，等用户态腾出位置后再提交。调用者持有 ring->lock。
+ */
+static int kv_ring_submit(struct kv_ring *ring, unsigned int to_submit)
+{
+	struct kv_ring_hdr *hdr = ring->hdr;
+	u32 head = ring->sq_head, cq_tail = ring->cq_tail;
+	u32 tail, cq_head;
+	unsigned int submitted = 0;
+
+	/* 与用户态写 sqe 后的 tail 发布配对 */
+	tail = smp_load_acquire(&hdr->sq_tail);
+	cq_head = smp_load_acquire(&hdr->cq_head);
+
+	while (submitted < to_submit && head != tail) {
+		struct kv_ring_sqe sqe;
+		struct kv_ring_cqe *cqe;
+		u32 vlen = 0;
+		int res;
+
+		if (cq_tail - cq_head >= ring->cq_entries) {
+			cq_head = smp_load_acquire(&hdr->cq_head);
+			if (cq_tail - cq_head >= ring->cq_entries) {
+				WRITE_ONCE(hdr->cq_overflow,
+					   READ_ONCE(hdr->cq_overflow) + 1);
+				break;
+			}
+		}
+
+		/* 用户态可能同时在改 sqe，先拷一份再用 */
+		memcpy(&sqe, &ring->sqes[head & (ring->sq_entries - 1)],
+		       sizeof(sqe));
+		res = kv_ring_issue(ring, &sqe, &vlen);
+
+		cqe = &ring->cqes[cq_tail & (ring->cq_entries - 1)];
+		cqe->user_data = sqe.user_data;
+		cqe->res = res;
+		cqe->len = vlen;
+		cq_tail++;
+		head++;
+		submitted++;
+	}
+
+	ring->sq_head = head;
+	ring->cq_tail = cq_tail;
+	smp_store_release(&hdr->sq_head, head);
+	/* cqe 的内容先于 tail 对用户态可见 */
+	smp_store_release(&hdr->cq_tail, cq_tail);
+	if (submitted)
+		wake_up_interruptible(&ring->cq_wait);
+	return submitted;
+}
+
+/*
+ * 轮询线程：有 sqe 就处理，空转超过 sq_idle 后在 sq.flags 里置
+ * KV_SQ_NEED_WAKEUP 并睡眠，直到 kv_ring_enter(KV_RING_ENTER_SQ_WAKEUP)。
+ *
+ * 只在忙的时候持有 mm_users：映射了环的 vma 持有这个 file，
+ * 一直持有会让 mm 和 file 互相等待，进程退出后谁也释放不了。
+ */
+static int kv_ring_sq_thread(void *data)
+{
+	struct kv_ring *ring = data;
+	struct kv_ring_hdr *hdr = ring->hdr;
+	struct mem_cgroup *old_memcg;
+	unsigned long timeout = jiffies + ring->sq_idle;
+	bool mm_held = false;
+	DEFINE_WAIT(wait);
+
+	old_memcg = set_active_memcg(ring->memcg);
+	while (!kthread_should_stop()) {
+		if (kv_ring_sq_pending(ring)) {
+			if (!mm_held) {
+				if (!mmget_not_zero(ring->mm)) {
+					/* 进程已经退出，等 release 来停掉我们 */
+					set_current_state(TASK_INTERRUPTIBLE);
+					if (!kthread_should_stop())
+						schedule();
+					__set_current_state(TASK_RUNNING);
+					continue;
+				}
+				kthread_use_mm(ring->mm);
+				mm_held = true;
+			}
+			mutex_lock(&ring->lock);
+			kv_ring_submit(ring, ring->sq_entries);
+			mutex_unlock(&ring->lock);
+			timeout = jiffies + ring->sq_idle;
+			cond_resched();
+			continue;
+		}
+
+		if (time_before(jiffies, timeout)) {
+			cond_resched();
+			cpu_relax();
+			continue;
+		}
+
+		if (mm_held) {
+			kthread_unuse_mm(ring->mm);
+			mmput(ring->mm);
+			mm_held = false;
+		}
+
+		prepare_to_wait(&ring->sq_wait, &wait, TASK_INTERRUPTIBLE);
+		WRITE_ONCE(hdr->sq_flags,
+			   READ_ONCE(hdr->sq_flags) | KV_SQ_NEED_WAKEUP);
+		/* 与用户态"写 tail 后读 flags"配对，避免丢失唤醒 */
+		smp_mb();
+		if (!kv_ring_sq_pending(ring) && !kthread_should_stop())
+			schedule();
+		finish_wait(&ring->sq_wait, &wait);
+		WRITE_ONCE(hdr->sq_flags,
+			   READ_ONCE(hdr->sq_flags) & ~KV_SQ_NEED_WAKEUP);
+		timeout = jiffies + ring->sq_idle;
+	}
+
+	if (mm_held) {
+		kthread_unuse_mm(ring->mm);
+		mmput(ring->mm);
+	}
+	set_active_memcg(old_memcg);
+	return 0;
+}
+
+static void kv_ring_free(struct kv_ring *ring)
+{
+	if (ring->sq_thread)
+		kthread_stop(ring->sq_thread);
+	if (ring->mm)
+		mmdrop(ring->mm);
+	mem_cgroup_put(ring->memcg);
+	kv_store_put(ring->kv);
+	vfree(ring->hdr);
+	kfree(ring->buf);
+	kfree(ring);
+}
+
+static int kv_ring_release(struct inode *inode, struct file *file)
+{
+	kv_ring_free(file->private_data);
+	return 0;
+}
+
+static int kv_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct kv_ring *ring = file->private_data;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > ring->size)
+		return -EINVAL;
+	return remap_vmalloc_range(vma, ring->hdr, 0);
+}
+
+static __poll_t kv_ring_poll(struct file *file, poll_table *wait)
+{
+	struct kv_ring *ring = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &ring->cq_wait, wait);
+	if (READ_ONCE(ring->hdr->cq_head) != READ_ONCE(ring->hdr->cq_tail))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	return mask;
+}
+
+static const struct file_operations kv_ring_fops = {
+	.release	= kv_ring_release,
+	.mmap		= kv_ring_mmap,
+	.poll		= kv_ring_poll,
+};
+
+static void kv_ring_fill_offsets(struct kv_ring *ring, struct kv_ring_params *p)
+{
+	p->sq_entries = ring->sq_entries;
+	p->cq_entries = ring->cq_entries;
+	p->ring_size = ring->size;
+
+	p->sq_off.head = offsetof(struct kv_ring_hdr, sq_head);
+	p->sq_off.tail = offsetof(struct kv_ring_hdr, sq_tail);
+	p->sq_off.ring_mask = offsetof(struct kv_ring_hdr, sq_ring_mask);
+	p->sq_off.ring_entries = offsetof(struct kv_ring_hdr, sq_ring_entries);
+	p->sq_off.flags = offsetof(struct kv_ring_hdr, sq_flags);
+	p->sq_off.sqes = (void *)ring->sqes - (void *)ring->hdr;
+
+	p->cq_off.head = offsetof(struct kv_ring_hdr, cq_head);
+	p->cq_off.tail = offsetof(struct kv_ring_hdr, cq_tail);
+	p->cq_off.ring_mask = offsetof(struct kv_ring_hdr, cq_ring_mask);
+	p->cq_off.ring_entries = offsetof(struct kv_ring_hdr, cq_ring_entries);
+	p->cq_off.overflow = offsetof(struct kv_ring_hdr, cq_overflow);
+	p->cq_off.cqes = (void *)ring->cqes - (void *)ring->hdr;
+}
+
+static struct kv_ring *kv_ring_alloc(u32 entries, struct kv_store *kv)
+{
+	struct kv_ring *ring;
+	size_t sq_off, cq_off;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL_ACCOUNT);
+	if (!ring)
+		return NULL;
+	ring->sq_entries = roundup_pow_of_two(entries);
+	ring->cq_entries = ring->sq_entries * 2;
+
+	sq_off = ALIGN(sizeof(struct kv_ring_hdr), SMP_CACHE_BYTES);
+	cq_off = sq_off + ring->sq_entries * sizeof(struct kv_ring_sqe);
+	ring->size = PAGE_ALIGN(cq_off +
+				ring->cq_entries * sizeof(struct kv_ring_cqe));
+
+	ring->hdr = vmalloc_user(ring->size);
+	ring->buf = kmalloc(KV_VALUE_MAX, GFP_KERNEL_ACCOUNT);
+	if (!ring->hdr || !ring->buf) {
+		vfree(ring->hdr);
+		kfree(ring->buf);
+		kfree(ring);
+		return NULL;
+	}
+	ring->sqes = (void *)ring->hdr + sq_off;
+	ring->cqes = (void *)ring->hdr + cq_off;
+	ring->hdr->sq_ring_mask = ring->sq_entries - 1;
+	ring->hdr->sq_ring_entries = ring->sq_entries;
+	ring->hdr->cq_ring_mask = ring->cq_entries - 1;
+	ring->hdr->cq_ring_entries = ring->cq_entries;
+
+	mutex_init(&ring->lock);
+	init_waitqueue_head(&ring->cq_wait);
+	init_waitqueue_head(&ring->sq_wait);
+
+	kv_store_get(kv);
+	ring->kv = kv;
+	mmgrab(current->mm);
+	ring->mm = current->mm;
+	ring->memcg = get_mem_cgroup_from_mm(current->mm);
+	return ring;
+}
+
+/*
+ * 创建一个环，返回 fd。环绑定在调用者线程组的 KV 表上（必要时创建），
+ * 带 KV_RING_SETUP_NS 时绑定在 ns_fd 的命名表上。
+ * 表的生命周期至少延续到 fd 关闭。
+ */
+SYSCALL_DEFINE2(kv_ring_setup, u32, entries,
+		struct kv_ring_params __user *, params)
+{
+	struct kv_ring_params p;
+	struct kv_store *kv;
+	struct kv_ring *ring;
+	int fd, i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++)
+		if (p.resv[i])
+			return -EINVAL;
+	if (p.flags & ~(KV_RING_SETUP_SQPOLL | KV_RING_SETUP_NS))
+		return -EINVAL;
+	if (!entries || entries > KV_RING_MAX_ENTRIES)
+		return -EINVAL;
+	/* 轮询线程会一直占着 CPU */
+	if ((p.flags & KV_RING_SETUP_SQPOLL) && !capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	if (p.flags & KV_RING_SETUP_NS) {
+		kv = kv_ns_get_fd(p.ns_fd);
+		if (IS_ERR(kv))
+			return PTR_ERR(kv);
+	} else {
+		kv = kv_store_get_or_create();
+		if (!kv)
+			return -ENOMEM;
+		kv_store_get(kv);
+	}
+	ring = kv_ring_alloc(entries, kv);
+	kv_store_put(kv);
+	if (!ring)
+		return -ENOMEM;
+
+	memset(&p.sq_off, 0, sizeof(p.sq_off));
+	memset(&p.cq_off, 0, sizeof(p.cq_off));
+	kv_ring_fill_offsets(ring, &p);
+
+	if (p.flags & KV_RING_SETUP_SQPOLL) {
+		ring->sq_idle = msecs_to_jiffies(p.sq_thread_idle ?: 1000);
+		ring->sq_thread = kthread_create(kv_ring_sq_thread, ring,
+						 "kv-ring-sq/%d", current->pid);
+		if (IS_ERR(ring->sq_thread)) {
+			fd = PTR_ERR(ring->sq_thread);
+			ring->sq_thread = NULL;
+			goto err;
+		}
+	}
+
+	if (copy_to_user(params, &p, sizeof(p))) {
+		fd = -EFAULT;
+		goto err;
+	}
+	fd = anon_inode_getfd("[kv_ring]", &kv_ring_fops, ring,
+			      O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		goto err;
+	/* fd 装好以后 ring 归 file 所有，不能再走 err */
+	if (ring->sq_thread)
+		wake_up_process(ring->sq_thread);
+	return fd;
+err:
+	kv_ring_free(ring);
+	return fd;
+}
+
+/*
+ * 不带 SQPOLL 时处理最多 @to_submit 条 sqe，返回处理的条数；完成环
+ * 已满、一条也提交不了时返回 -EBUSY。
+ * 带 SQPOLL 时只负责按 KV_RING_ENTER_SQ_WAKEUP 唤醒轮询线程，返回 0。
+ */
+SYSCALL_DEFINE3(kv_ring_enter, unsigned int, fd, u32, to_submit, u32, flags)
+{
+	struct kv_ring *ring;
+	struct fd f;
+	long ret;
+
+	if (flags & ~KV_RING_ENTER_SQ_WAKEUP)
+		return -EINVAL;
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+	ret = -EOPNOTSUPP;
+	if (f.file->f_op != &kv_ring_fops)
+		goto out;
+	ring = f.file->private_data;
+	/* 环上的操作不经过写缓冲区，排在本线程之前缓冲的写入之后 */
+	kv_wbuf_flush_current(false);
+
+	if (ring->sq_thread) {
+		if (flags & KV_RING_ENTER_SQ_WAKEUP)
+			wake_up(&ring->sq_wait);
+		ret = 0;
+		goto out;
+	}
+
+	/* sqe 里的地址只在创建环的地址空间里有意义 */
+	ret = -EPERM;
+	if (current->mm != ring->mm)
+		goto out;
+
+	ret = 0;
+	to_submit = min(to_submit, ring->sq_entries);
+	if (to_submit) {
+		mutex_lock(&ring->lock);
+		ret = kv_ring_submit(ring, to_submit);
+		mutex_unlock(&ring->lock);
+		if (!ret && kv_ring_sq_pending(ring))
+			ret = -EBUSY;
+	}
+out:
+	fdput(f);
+	return ret;
+}
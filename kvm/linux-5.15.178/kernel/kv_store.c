@@ -2,67 +2,2599 @@
 #include <linux/syscalls.h>
 #include <linux/sched.h>
 #include <linux/uaccess.h>
-#include <linux/printk.h>
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
-#include <linux/list.h>
+#include <linux/rhashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/signal.h>
+#include <linux/workqueue.h>
+#include <linux/sysctl.h>
+#include <linux/rbtree.h>
+#include <linux/sort.h>
+#include <linux/hash.h>
+#include <linux/bitmap.h>
+#include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/crc32.h>
+#include <linux/kv_vindex.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/kv_store.h>
+#include <linux/kv_store.h>
+
+/*
+ * 读路径不加锁：查找只在 rcu_read_lock() 下进行，写者之间由 rhashtable
+ * 的桶锁串行化。因此节点一旦插入表中，就只能在 RCU 宽限期之后释放。
+ *
+ * 值的长度在节点的生命周期内不变。不超过 8 字节的值放在 word 里，同长度
+ * 更新用 WRITE_ONCE 原地完成；其余更新都换一个新节点（rhashtable_replace_fast），
+ * 读者看到的要么是旧值要么是新值。超过 KV_INLINE_SIZE 的值另外分配。
+ *
+ * 节点正好一个缓存行，按缓存行对齐分配：查找顺着链比较 key、命中后读值、
+ * 看过期时间都落在同一行里。
+ */
 struct my_data {
-	int key;
-	int value;
-	struct hlist_node node;
+	struct rhash_head node;
+	u64 key;
+	u32 len;
+	u8 referenced;			/* CLOCK 淘汰的访问位 */
+	u8 ordered;			/* 是 struct kv_ordered_data，分配自 kv_ordered_cachep */
+	union {
+		u64 word;
+		u8 inline_val[KV_INLINE_SIZE];
+		void *ext;
+	};
+	unsigned long expires;		/* jiffies，0 表示不过期 */
+	struct rcu_head rcu;
+};
+
+/* KV_MODE_ORDERED 的节点多一个红黑树节点，其它表不为它多占半行 */
+struct kv_ordered_data {
+	struct my_data d;
+	struct rb_node rb;
+};
+
+/* 专用 slab，节点紧凑排布，也能在 /proc/slabinfo 里单独看到 */
+static struct kmem_cache *kv_entry_cachep __ro_after_init;
+static struct kmem_cache *kv_ordered_cachep __ro_after_init;
+
+static inline struct rb_node *kv_rb(struct my_data *entry)
+{
+	return &container_of(entry, struct kv_ordered_data, d)->rb;
+}
+
+static inline struct my_data *kv_rb_entry(struct rb_node *node)
+{
+	return &rb_entry(node, struct kv_ordered_data, rb)->d;
+}
+
+/*
+ * 键用 jhash 散列，不再直接取低 10 位；桶数随元素个数自动扩容/缩容，
+ * 负载因子保持在 0.75 以下，任意规模下链长都是常数。
+ */
+static const struct rhashtable_params kv_params = {
+	.key_len		= sizeof(u64),
+	.key_offset		= offsetof(struct my_data, key),
+	.head_offset		= offsetof(struct my_data, node),
+	.automatic_shrinking	= true,
+};
+
+/* 每个进程最多能存的条目数，0 表示不限制；新建的表取当时的值 */
+static int sysctl_kv_max_entries __read_mostly;
+
+static struct ctl_table kv_sysctl_table[] = {
+	{
+		.procname	= "kv_max_entries",
+		.data		= &sysctl_kv_max_entries,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	},
+	{ }
+};
+
+static int __init kv_store_sysctl_init(void)
+{
+	register_sysctl("kernel", kv_sysctl_table);
+	return 0;
+}
+core_initcall(kv_store_sysctl_init);
+
+/* 还没有表的线程组的 [vkv] 都映射这一页，magic 为 0，vDSO 一律回退 */
+static struct page *kv_vindex_empty __ro_after_init;
+
+void __init kv_store_cache_init(void)
+{
+	BUILD_BUG_ON(sizeof(struct my_data) > L1_CACHE_BYTES);
+	/* 条目计入分配者所在的 memcg */
+	kv_entry_cachep = KMEM_CACHE(my_data, SLAB_PANIC | SLAB_ACCOUNT |
+					      SLAB_HWCACHE_ALIGN);
+	kv_ordered_cachep = KMEM_CACHE(kv_ordered_data,
+				       SLAB_PANIC | SLAB_ACCOUNT);
+	kv_vindex_empty = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!kv_vindex_empty)
+		panic("kv_store: cannot allocate empty vindex page\n");
+}
+
+/* 释放时攒一批再交给 kmem_cache_free_bulk */
+struct kv_free_batch {
+	unsigned int nr;
+	void *objs[64];
+};
+
+static inline bool kv_len_inline(u32 len)
+{
+	return len <= KV_INLINE_SIZE;
+}
+
+static inline bool kv_len_word(u32 len)
+{
+	return len <= sizeof(u64);
+}
+
+static inline struct kmem_cache *kv_entry_cache(bool ordered)
+{
+	return ordered ? kv_ordered_cachep : kv_entry_cachep;
+}
+
+static struct my_data *kv_entry_alloc(bool ordered)
+{
+	struct my_data *entry;
+
+	entry = kmem_cache_alloc(kv_entry_cache(ordered), GFP_KERNEL);
+	if (entry)
+		entry->ordered = ordered;
+	return entry;
+}
+
+/* 节点从未发布或已经没有读者 */
+static void kv_entry_destroy(struct my_data *entry)
+{
+	if (!kv_len_inline(entry->len))
+		kfree(entry->ext);
+	kmem_cache_free(kv_entry_cache(entry->ordered), entry);
+}
+
+static void kv_entry_free_rcu(struct rcu_head *head)
+{
+	kv_entry_destroy(container_of(head, struct my_data, rcu));
+}
+
+/* 节点刚从表里摘下，可能还有读者 */
+static void kv_entry_free(struct my_data *entry)
+{
+	call_rcu(&entry->rcu, kv_entry_free_rcu);
+}
+
+static int kv_entry_fill(struct my_data *entry, u64 key, const void *val,
+			 u32 len)
+{
+	entry->key = key;
+	entry->len = len;
+	entry->referenced = 0;
+	entry->expires = 0;
+	memset(entry->inline_val, 0, sizeof(entry->inline_val));
+	if (kv_len_inline(len)) {
+		memcpy(entry->inline_val, val, len);
+		return 0;
+	}
+	entry->ext = kmemdup(val, len, GFP_KERNEL_ACCOUNT);
+	return entry->ext ? 0 : -ENOMEM;
+}
+
+/* 过期的条目在被清理之前对读者来说就是不存在 */
+static inline bool kv_expired(const struct my_data *entry)
+{
+	unsigned long expires = READ_ONCE(entry->expires);
+
+	return expires && time_after_eq(jiffies, expires);
+}
+
+/* @ms 毫秒之后的过期时间；低位置 1，jiffies 回绕到 0 时也不会被当成不过期 */
+static inline unsigned long kv_ttl_deadline(unsigned int ms)
+{
+	return ms ? (jiffies + msecs_to_jiffies(ms)) | 1 : 0;
+}
+
+/* 同长度的小值原地更新，读者用 READ_ONCE 整字读取 */
+static void kv_entry_set_word(struct my_data *entry, const void *val)
+{
+	u64 word = 0;
+
+	memcpy(&word, val, entry->len);
+	WRITE_ONCE(entry->word, word);
+}
+
+/* 调用者持有 rcu_read_lock()，@buf 至少有 entry->len 字节 */
+static void kv_entry_read(const struct my_data *entry, void *buf)
+{
+	if (kv_len_word(entry->len)) {
+		u64 word = READ_ONCE(entry->word);
+
+		memcpy(buf, &word, entry->len);
+	} else {
+		memcpy(buf, kv_len_inline(entry->len) ?
+			    entry->inline_val : entry->ext, entry->len);
+	}
+}
+
+static void kv_entry_free_batched(void *ptr, void *arg)
+{
+	struct kv_free_batch *batch = arg;
+	struct my_data *entry = ptr;
+
+	if (entry->ordered) {
+		kv_entry_destroy(entry);
+		return;
+	}
+	if (!kv_len_inline(entry->len))
+		kfree(entry->ext);
+	batch->objs[batch->nr++] = ptr;
+	if (batch->nr == ARRAY_SIZE(batch->objs)) {
+		kmem_cache_free_bulk(kv_entry_cachep, batch->nr, batch->objs);
+		batch->nr = 0;
+	}
+}
+
+/*
+ * 表由 1 个（普通模式）或 KV_NR_SEGS 个（KV_MODE_INHERIT）段组成，
+ * 键按 hash_64 分到段上。fork 时子进程的表直接引用父进程的段，
+ * 谁先写某个段谁就复制一份自己的（写时复制）。
+ * 被共享的段里的条目不可修改。决定要不要复制只看 share，遍历时临时
+ * 持有的 ref 不算，否则一次遍历就会让写者复制出一个没人用的段。
+ */
+struct kv_seg {
+	struct rhashtable ht;
+	refcount_t ref;			/* 生命周期：引用它的表各一个，加上遍历者 */
+	atomic_t share;			/* 引用这个段的表的个数 */
+	struct rcu_work free_rwork;
+};
+
+/*
+ * 最后一个引用已经放掉，等一个 RCU 宽限期后不会再有读者，条目可以
+ * 直接释放。rhashtable_free_and_destroy() 要等扩容 worker 结束，
+ * 只能在进程上下文做。
+ */
+static void kv_seg_free_work(struct work_struct *work)
+{
+	struct kv_seg *seg = container_of(to_rcu_work(work), struct kv_seg,
+					  free_rwork);
+	struct kv_free_batch batch = { .nr = 0 };
+
+	rhashtable_free_and_destroy(&seg->ht, kv_entry_free_batched, &batch);
+	if (batch.nr)
+		kmem_cache_free_bulk(kv_entry_cachep, batch.nr, batch.objs);
+	kfree(seg);
+}
+
+static struct kv_seg *kv_seg_alloc(void)
+{
+	struct kv_seg *seg;
+
+	seg = kzalloc(sizeof(*seg), GFP_KERNEL_ACCOUNT);
+	if (!seg)
+		return NULL;
+	if (rhashtable_init(&seg->ht, &kv_params)) {
+		kfree(seg);
+		return NULL;
+	}
+	refcount_set(&seg->ref, 1);
+	atomic_set(&seg->share, 1);
+	INIT_RCU_WORK(&seg->free_rwork, kv_seg_free_work);
+	return seg;
+}
+
+static void kv_seg_put(struct kv_seg *seg)
+{
+	if (seg && refcount_dec_and_test(&seg->ref))
+		queue_rcu_work(system_wq, &seg->free_rwork);
+}
+
+/* 表不再引用 @seg */
+static void kv_seg_drop(struct kv_seg *seg)
+{
+	if (!seg)
+		return;
+	atomic_dec(&seg->share);
+	kv_seg_put(seg);
+}
+
+static inline bool kv_inherit(struct kv_store *kv)
+{
+	return kv->mode & KV_MODE_INHERIT;
+}
+
+static inline bool kv_buffered(struct kv_store *kv)
+{
+	return kv && (kv->mode & KV_MODE_BUFFERED);
+}
+
+/* 过期清理的周期 */
+#define KV_SWEEP_INTERVAL	HZ
+
+/*
+ * 写带过期时间的条目时调用。周期清理在一整轮没见到带过期时间的条目时
+ * 停下（见 kv_expire_work()），每轮开始时清掉 ttl_fresh；本轮第一次
+ * 这样的写入把它置上并保证清理在排队，之后的写入什么都不做。
+ */
+static inline void kv_ttl_arm(struct kv_store *kv)
+{
+	if (likely(READ_ONCE(kv->ttl_fresh)))
+		return;
+	if (!READ_ONCE(kv->ttl_used))
+		WRITE_ONCE(kv->ttl_used, true);
+	WRITE_ONCE(kv->ttl_fresh, true);
+	/* 已经在排队时什么都不做 */
+	schedule_delayed_work(&kv->expire_work, KV_SWEEP_INTERVAL);
+}
+
+/* 写入时调用：过期时间按默认 TTL 重新计算，访问位置 1 */
+static inline void kv_entry_touch(struct kv_store *kv, struct my_data *entry)
+{
+	unsigned int ttl = READ_ONCE(kv->default_ttl);
+
+	WRITE_ONCE(entry->expires, kv_ttl_deadline(ttl));
+	if (!READ_ONCE(entry->referenced))
+		WRITE_ONCE(entry->referenced, 1);
+	if (ttl)
+		kv_ttl_arm(kv);
+}
+
+#define kv_stat_inc(kv, field)	this_cpu_inc((kv)->stats->field)
+
+/* 拿不到锁就记一次争用再等 */
+static inline void kv_spin_lock(struct kv_store *kv, spinlock_t *lock)
+{
+	if (!spin_trylock(lock)) {
+		kv_stat_inc(kv, contended);
+		spin_lock(lock);
+	}
+}
+
+static inline unsigned int kv_nr_segs(struct kv_store *kv)
+{
+	return 1U << kv->seg_bits;
+}
+
+static inline unsigned int kv_seg_idx(struct kv_store *kv, u64 key)
+{
+	return kv->seg_bits ? hash_64(key, kv->seg_bits) : 0;
+}
+
+/* 调用者持有 rcu_read_lock() */
+static inline struct kv_seg *kv_seg(struct kv_store *kv, u64 key)
+{
+	return rcu_dereference(kv->segs[kv_seg_idx(kv, key)]);
+}
+
+/* 取第 @i 个段并持有引用，遍历期间段被写时复制换掉也不会释放 */
+static struct kv_seg *kv_seg_pin(struct kv_store *kv, unsigned int i)
+{
+	struct kv_seg *seg;
+
+	rcu_read_lock();
+	do {
+		seg = rcu_dereference(kv->segs[i]);
+	} while (!refcount_inc_not_zero(&seg->ref));
+	rcu_read_unlock();
+	return seg;
+}
+
+static int kv_nelems(struct kv_store *kv)
+{
+	unsigned int i;
+	int n = 0;
+
+	rcu_read_lock();
+	for (i = 0; i < kv_nr_segs(kv); i++)
+		n += atomic_read(&rcu_dereference(kv->segs[i])->ht.nelems);
+	rcu_read_unlock();
+	return n;
+}
+
+/*
+ * 在表上绕圈的游标，过期清理和 CLOCK 淘汰各用一个：每次只往前走一小段，
+ * 不会在一次写入里遍历整张表。游标只记位置，不持有段的引用（持有引用
+ * 会让写者以为段被共享而去复制），每次在 RCU 下对当时的段重新 enter，
+ * 按记下的桶号和桶内序号接着走。扩缩容或段被写时复制换掉以后可能
+ * 重复或漏掉个别条目，对这两种用途都无妨。
+ */
+
+/*
+ * 从上次停下的地方往后看最多 @budget 个条目，逐个交给 @fn，@fn 返回
+ * true 时停下。@fn 在 RCU 读临界区里调用。调用者保证同一个游标不被
+ * 并发使用。
+ */
+static void kv_cursor_scan(struct kv_store *kv, struct kv_cursor *c,
+			   unsigned int budget,
+			   bool (*fn)(struct my_data *entry, void *arg),
+			   void *arg)
+{
+	struct rhashtable_iter iter;
+	struct my_data *entry;
+	unsigned int opened = 0;
+
+	/* 表是空的或比预算小，转一圈就够了 */
+	while (budget && opened++ <= kv_nr_segs(kv)) {
+		rcu_read_lock();
+		rhashtable_walk_enter(&rcu_dereference(kv->segs[c->idx])->ht,
+				      &iter);
+		/* 没有 p 时 rhashtable_walk_start() 从 slot/skip 接着找 */
+		iter.slot = c->slot;
+		iter.skip = c->skip;
+		rhashtable_walk_start(&iter);
+		while (budget && (entry = rhashtable_walk_next(&iter))) {
+			if (IS_ERR(entry))
+				continue;	/* -EAGAIN：表在扩缩容，接着走 */
+			budget--;
+			if (fn(entry, arg))
+				budget = 0;
+		}
+		rhashtable_walk_stop(&iter);
+		rhashtable_walk_exit(&iter);
+		rcu_read_unlock();
+
+		/* 预算没用完说明这个段走到头了 */
+		if (budget) {
+			c->idx = (c->idx + 1) & (kv_nr_segs(kv) - 1);
+			c->slot = 0;
+			c->skip = 0;
+		} else {
+			c->slot = iter.slot;
+			c->skip = iter.skip;
+		}
+	}
+}
+
+static void kv_vindex_free(struct kv_vindex *vi);
+static void kv_expire_work(struct work_struct *work);
+
+static void kv_store_free_work(struct work_struct *work)
+{
+	struct kv_store *kv = container_of(to_rcu_work(work), struct kv_store,
+					   free_rwork);
+	unsigned int i;
+
+	/* 清理 work 会自己续期，cancel_delayed_work_sync() 能处理这种情况 */
+	cancel_delayed_work_sync(&kv->expire_work);
+	kv_vindex_free(kv->vindex);
+	for (i = 0; i < kv_nr_segs(kv); i++)
+		kv_seg_drop(rcu_dereference_protected(kv->segs[i], true));
+	free_percpu(kv->writers);
+	free_percpu(kv->stats);
+	kfree(kv);
+}
+
+/* 只分配表头，段由调用者填 */
+static struct kv_store *__kv_store_alloc(unsigned int mode)
+{
+	unsigned int seg_bits = mode & KV_MODE_INHERIT ? KV_SEG_BITS : 0;
+	struct kv_store *kv;
+
+	kv = kzalloc(struct_size(kv, segs, 1U << seg_bits), GFP_KERNEL_ACCOUNT);
+	if (!kv)
+		return NULL;
+	kv->stats = alloc_percpu_gfp(struct kv_pcpu_stats, GFP_KERNEL_ACCOUNT);
+	if (!kv->stats) {
+		kfree(kv);
+		return NULL;
+	}
+	if (mode & KV_MODE_INHERIT) {
+		kv->writers = alloc_percpu_gfp(int, GFP_KERNEL_ACCOUNT);
+		if (!kv->writers) {
+			free_percpu(kv->stats);
+			kfree(kv);
+			return NULL;
+		}
+	}
+	refcount_set(&kv->users, 1);
+	kv->max_entries = READ_ONCE(sysctl_kv_max_entries);
+	kv->mode = mode;
+	kv->seg_bits = seg_bits;
+	spin_lock_init(&kv->ordered_lock);
+	kv->ordered = RB_ROOT;
+	mutex_init(&kv->cow_lock);
+	init_waitqueue_head(&kv->fork_wait);
+	mutex_init(&kv->evict_lock);
+	INIT_DELAYED_WORK(&kv->expire_work, kv_expire_work);
+	INIT_RCU_WORK(&kv->free_rwork, kv_store_free_work);
+	return kv;
+}
+
+struct kv_store *kv_store_alloc(unsigned int mode)
+{
+	struct kv_store *kv = __kv_store_alloc(mode);
+	unsigned int i;
+
+	if (!kv)
+		return NULL;
+	for (i = 0; i < kv_nr_segs(kv); i++) {
+		struct kv_seg *seg = kv_seg_alloc();
+
+		if (!seg) {
+			/* 没填的段是 NULL，kv_seg_drop() 会跳过 */
+			kv_store_free_work(&kv->free_rwork.work);
+			return NULL;
+		}
+		RCU_INIT_POINTER(kv->segs[i], seg);
+	}
+	/* 新段只属于这张表 */
+	bitmap_fill(kv->owned, kv_nr_segs(kv));
+	return kv;
+}
+
+void kv_store_get(struct kv_store *kv)
+{
+	if (kv)
+		refcount_inc(&kv->users);
+}
+
+/*
+ * 可能在 RCU 回调里被调用（free_task），真正的释放推迟到 workqueue，
+ * 进程退出时也不用等上百万个条目逐个释放完。多等一个 RCU 宽限期，
+ * 别的进程（/proc 读者）可以在 RCU 下用 refcount_inc_not_zero() 取表。
+ */
+void kv_store_put(struct kv_store *kv)
+{
+	if (kv && refcount_dec_and_test(&kv->users))
+		queue_rcu_work(system_wq, &kv->free_rwork);
+}
+
+/* 取 @task 所在线程组的表并持有引用，没有表时返回 NULL */
+struct kv_store *kv_store_get_task(struct task_struct *task)
+{
+	struct kv_store *kv;
+
+	rcu_read_lock();
+	kv = READ_ONCE(task->group_leader->kv_store);
+	if (kv && !refcount_inc_not_zero(&kv->users))
+		kv = NULL;
+	rcu_read_unlock();
+	return kv;
+}
+
+/*
+ * 线程组共享的表挂在 group_leader 上，其它线程的 kv_store 始终为 NULL。
+ * exec 时丢掉表（见 exec_kv_store()），新进程映像从一张空表开始。
+ */
+static inline struct kv_store **kv_slot(struct task_struct *tsk)
+{
+	return &tsk->group_leader->kv_store;
+}
+
+/* 返回当前线程组的表，可能为 NULL（还没写过），此时视为空表 */
+static struct kv_store *kv_store_current(void)
+{
+	return READ_ONCE(*kv_slot(current));
+}
+
+/* 没有 [vkv] 的架构不用管 */
+void __weak vkv_reset(struct mm_struct *mm)
+{
+}
+
+/*
+ * 把 @kv 装成当前线程组的表，已经有表时返回原来的表，装上了返回 NULL。
+ * 装上以后让 [vkv] 重新缺页，之前那里映射的是 kv_vindex_empty。
+ */
+static struct kv_store *kv_store_install(struct kv_store *kv)
+{
+	struct kv_store *old = cmpxchg(kv_slot(current), NULL, kv);
+
+	if (!old && current->mm)
+		vkv_reset(current->mm);
+	return old;
+}
+
+/*
+ * 第一次写入时才分配表，fork 不再为从不使用 KV 的进程付出代价。
+ * 多个线程同时第一次写入时用 cmpxchg 决出胜者，输家释放自己的空表。
+ */
+struct kv_store *kv_store_get_or_create(void)
+{
+	struct kv_store *kv = kv_store_current(), *old;
+
+	if (likely(kv))
+		return kv;
+
+	kv = kv_store_alloc(0);
+	if (!kv)
+		return NULL;
+	old = kv_store_install(kv);
+	if (old) {
+		kv_store_put(kv);
+		return old;
+	}
+	return kv;
+}
+
+/*
+ * 线程退出时调用。do_exit() 在 exit_mm() 之前已经递减了 signal->live，
+ * 线程组里最后一个线程退出时整张表被释放；几个线程同时看到 0 时由 xchg
+ * 保证只释放一次。
+ */
+void exit_kv_store(struct task_struct *tsk)
+{
+	if (atomic_read(&tsk->signal->live))
+		return;
+	kv_store_put(xchg(kv_slot(tsk), NULL));
+}
+
+/*
+ * exec 时调用，de_thread() 之后 @tsk 已经是线程组里唯一的线程。不管谁
+ * exec，新映像都从空表开始：KV_CTL_ATTACH 挂上的命名表不能带进 setuid
+ * 程序，否则没有特权的进程能按名字读写它的数据。缓冲区先刷回旧表。
+ */
+void exec_kv_store(struct task_struct *tsk)
+{
+	exit_kv_wbuf(tsk);
+	kv_store_put(xchg(kv_slot(tsk), NULL));
+}
+
+/* v1 接口的 int 键按符号扩展映射到 64 位键空间 */
+static inline u64 kv_key(int k)
+{
+	return (u64)(s64)k;
+}
+
+/* 调用者持有 rcu_read_lock() */
+static struct my_data *kv_lookup(struct kv_store *kv, u64 key)
+{
+	return rhashtable_lookup(&kv_seg(kv, key)->ht, &key, kv_params);
+}
+
+/*
+ * fork 与写者互斥：段只会在没有写者的时候被共享出去。只有
+ * KV_MODE_INHERIT 的表才会被 fork 共享，其它表不用加锁。
+ *
+ * 写者先在自己 CPU 的 writers 上加一再看 forking，fork 先置 forking
+ * 再等所有 CPU 的 writers 加起来为 0，两边中间各有一个 smp_mb()，
+ * 至少有一边能看到另一边。和 percpu_rw_semaphore 的区别是写者每次多
+ * 一个内存屏障，换来 fork 不用等 RCU 宽限期。
+ */
+static inline void kv_fork_lock(struct kv_store *kv)
+{
+	if (!kv_inherit(kv))
+		return;
+	for (;;) {
+		this_cpu_inc(*kv->writers);
+		smp_mb();
+		/* acquire：看到 fork 做完也就看到它清掉的 owned */
+		if (likely(!smp_load_acquire(&kv->forking)))
+			return;
+		/* 退回去等 fork 做完 */
+		this_cpu_dec(*kv->writers);
+		smp_mb();
+		wake_up_all(&kv->fork_wait);
+		wait_event(kv->fork_wait, !READ_ONCE(kv->forking));
+	}
+}
+
+static inline void kv_fork_unlock(struct kv_store *kv)
+{
+	if (!kv_inherit(kv))
+		return;
+	smp_mb();
+	this_cpu_dec(*kv->writers);
+	/* 与 kv_fork_begin() 的 smp_mb() 配对，不会漏掉唤醒 */
+	smp_mb();
+	if (unlikely(READ_ONCE(kv->forking)))
+		wake_up_all(&kv->fork_wait);
+}
+
+/* 写者可能在一个 CPU 上加、在另一个 CPU 上减，只有总和有意义 */
+static bool kv_writers_idle(struct kv_store *kv)
+{
+	int cpu, sum = 0;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(*kv->writers, cpu);
+	return !sum;
+}
+
+/* 挡住新写者并等正在写的做完，同一张表的几个 fork 一个一个来 */
+static void kv_fork_begin(struct kv_store *kv)
+{
+	wait_event(kv->fork_wait, !cmpxchg(&kv->forking, 0, 1));
+	smp_mb();
+	wait_event(kv->fork_wait, kv_writers_idle(kv));
+}
+
+static void kv_fork_end(struct kv_store *kv)
+{
+	smp_store_release(&kv->forking, 0);
+	wake_up_all(&kv->fork_wait);
+}
+
+/*
+ * 复制一个被共享的段。段被共享期间没有人修改它，条目可以直接拷；
+ * 遍历时表可能在收缩，重复看到的节点插入会失败，丢掉即可。
+ */
+static struct kv_seg *kv_seg_clone(struct kv_seg *old)
+{
+	struct rhashtable_iter iter;
+	struct my_data *entry, *copy;
+	struct kv_seg *seg;
+	int ret = 0;
+
+	seg = kv_seg_alloc();
+	if (!seg)
+		return NULL;
+
+	rhashtable_walk_enter(&old->ht, &iter);
+	rhashtable_walk_start(&iter);
+	while ((entry = rhashtable_walk_next(&iter))) {
+		if (IS_ERR(entry))
+			continue;
+		/* 分配可能睡眠，先停下遍历；old 被我们引用着，条目不会释放 */
+		rhashtable_walk_stop(&iter);
+		copy = kv_entry_alloc(false);	/* 有序模式不能继承 */
+		ret = -ENOMEM;
+		if (copy)
+			ret = kv_entry_fill(copy, entry->key,
+					    kv_len_inline(entry->len) ?
+					    entry->inline_val : entry->ext,
+					    entry->len);
+		if (!ret)
+			copy->expires = READ_ONCE(entry->expires);
+		if (!ret && rhashtable_lookup_insert_fast(&seg->ht, &copy->node,
+							  kv_params))
+			kv_entry_destroy(copy);
+		else if (ret && copy)
+			kv_entry_destroy(copy);
+		rhashtable_walk_start(&iter);
+		if (ret)
+			break;
+	}
+	rhashtable_walk_stop(&iter);
+	rhashtable_walk_exit(&iter);
+
+	if (ret) {
+		kv_seg_put(seg);
+		return NULL;
+	}
+	return seg;
+}
+
+/*
+ * kv->owned 里第 @i 位置上的段才允许原地修改。这一位只在 cow_lock 下
+ * 置上，fork 时清掉：别的写者正在复制第 @i 段时，同一张表的写者都得
+ * 排在 cow_lock 后面，不会往正在被复制的旧段里写。
+ */
+static inline bool kv_seg_owned(struct kv_store *kv, unsigned int i)
+{
+	if (!test_bit(i, kv->owned))
+		return false;
+	/* 与 kv_seg_unshare() 里的 smp_mb__before_atomic() 配对，看到新段 */
+	smp_rmb();
+	return true;
+}
+
+/* 写 @key 之前调用，保证它所在的段只属于 @kv。调用者持有 kv_fork_lock() */
+static int kv_seg_unshare(struct kv_store *kv, u64 key)
+{
+	unsigned int i = kv_seg_idx(kv, key);
+	struct kv_seg *seg, *copy;
+	int ret = 0;
+
+	if (!kv_inherit(kv) || kv_seg_owned(kv, i))
+		return 0;
+
+	if (!mutex_trylock(&kv->cow_lock)) {
+		kv_stat_inc(kv, contended);
+		mutex_lock(&kv->cow_lock);
+	}
+	if (test_bit(i, kv->owned))
+		goto out;
+	seg = rcu_dereference_protected(kv->segs[i],
+					lockdep_is_held(&kv->cow_lock));
+	/*
+	 * share 只在 fork 时增加，fork 和我们互斥；别的表换掉这个段时
+	 * 先复制完才减 share，所以看到 1 就说明没有人还在读它来复制。
+	 */
+	if (atomic_read(&seg->share) > 1) {
+		copy = kv_seg_clone(seg);
+		if (!copy) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		kv_stat_inc(kv, cow_copies);
+		rcu_assign_pointer(kv->segs[i], copy);
+		kv_seg_drop(seg);
+	}
+	smp_mb__before_atomic();
+	set_bit(i, kv->owned);
+out:
+	mutex_unlock(&kv->cow_lock);
+	return ret;
+}
+
+/*
+ * fork 时调用（copy_process），调用者是父进程。父进程的表是
+ * KV_MODE_INHERIT 时，子进程得到一张共享全部段的新表，代价与条目数无关。
+ */
+int copy_kv_store(unsigned long clone_flags, struct task_struct *p)
+{
+	struct kv_store *parent, *kv;
+	unsigned int i;
+
+	p->kv_store = NULL;
+	if (clone_flags & CLONE_THREAD)
+		return 0;
+	parent = kv_store_current();
+	if (!parent || !kv_inherit(parent))
+		return 0;
+	/* 父线程自己缓冲的写入要让子进程看到 */
+	kv_wbuf_flush_current(false);
+
+	kv = __kv_store_alloc(parent->mode);
+	if (!kv)
+		return -ENOMEM;
+	kv->max_entries = parent->max_entries;
+	kv->default_ttl = parent->default_ttl;
+	kv->capacity = parent->capacity;
+
+	kv_fork_begin(parent);
+	for (i = 0; i < kv_nr_segs(parent); i++) {
+		struct kv_seg *seg = rcu_dereference_protected(parent->segs[i],
+							       true);
+
+		refcount_inc(&seg->ref);
+		atomic_inc(&seg->share);
+		RCU_INIT_POINTER(kv->segs[i], seg);
+	}
+	/* 子进程的表 owned 全为 0，父进程的也清掉，下次写时再决定复不复制 */
+	bitmap_zero(parent->owned, kv_nr_segs(parent));
+	kv_fork_end(parent);
+	/* 继承来的条目可能带着过期时间 */
+	if (READ_ONCE(parent->ttl_used))
+		kv_ttl_arm(kv);
+
+	p->kv_store = kv;
+	return 0;
+}
+
+/*
+ * [vkv] 快照。第一次有线程访问映射时才创建，之后每次修改 int 键都
+ * 在 vi->lock 下按表里的当前状态同步一次：最后一个修改者同步时读到的
+ * 一定是最终状态，所以并发写者之间不用再约定顺序。
+ * 页面由快照和映射各持有引用，表释放后仍在用的映射不会读到已释放的页。
+ */
+struct kv_vindex {
+	struct page *pages[KV_VINDEX_PAGES];
+	struct kv_vindex_hdr *hdr;	/* vmap 后的内核地址 */
+	spinlock_t lock;
+};
+
+static void kv_vindex_free(struct kv_vindex *vi)
+{
+	int i;
+
+	if (!vi)
+		return;
+	vunmap(vi->hdr);
+	for (i = 0; i < KV_VINDEX_PAGES; i++)
+		if (vi->pages[i])
+			put_page(vi->pages[i]);
+	kfree(vi);
+}
+
+static int kv_vindex_find(struct kv_vindex_hdr *hdr, s32 k, bool *found)
+{
+	struct kv_vslot *slots = kv_vindex_slots(hdr);
+	u32 i = kv_vindex_hash(k);
+
+	while (slots[i].used && slots[i].key != k)
+		i = (i + 1) & (KV_VINDEX_SLOTS - 1);
+	*found = slots[i].used;
+	return i;
+}
+
+/* 线性探测的删除：把后面探测链上的元素往前挪，不留墓碑 */
+static void kv_vindex_remove(struct kv_vindex_hdr *hdr, u32 i)
+{
+	struct kv_vslot *slots = kv_vindex_slots(hdr);
+	const u32 mask = KV_VINDEX_SLOTS - 1;
+	u32 j = i, home;
+
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!slots[j].used)
+			break;
+		home = kv_vindex_hash(slots[j].key);
+		/* home 不在 (i, j] 之间时，j 上的元素可以挪到 i */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i].used = 0;
+	hdr->nr_used--;
+}
+
+/* 调用者持有 vi->lock */
+static void kv_vindex_update(struct kv_vindex_hdr *hdr, s32 k, bool present,
+			     s32 v)
+{
+	struct kv_vslot *slots = kv_vindex_slots(hdr);
+	bool found;
+	u32 i = kv_vindex_find(hdr, k, &found);
+
+	if (present) {
+		if (found) {
+			slots[i].value = v;
+		} else if (hdr->nr_used < KV_VINDEX_MAX_USED) {
+			slots[i].key = k;
+			slots[i].value = v;
+			slots[i].used = 1;
+			hdr->nr_used++;
+		} else {
+			hdr->flags |= KV_VINDEX_OVERFLOW;
+		}
+	} else if (found) {
+		kv_vindex_remove(hdr, i);
+	}
+}
+
+static void kv_vindex_sync(struct kv_store *kv, struct kv_vindex *vi, u64 key)
+{
+	struct kv_vindex_hdr *hdr = vi->hdr;
+	struct my_data *entry;
+	bool present = false, ttl = false;
+	s32 v = 0;
+
+	kv_spin_lock(kv, &vi->lock);
+	rcu_read_lock();
+	entry = kv_lookup(kv, key);
+	/* vDSO 判断不了过期，带过期时间的条目不收录 */
+	if (entry && READ_ONCE(entry->expires))
+		ttl = true;
+	else if (entry && entry->len == sizeof(v)) {
+		kv_entry_read(entry, &v);
+		present = true;
+	}
+	rcu_read_unlock();
+
+	WRITE_ONCE(hdr->seq, hdr->seq + 1);
+	smp_wmb();
+	if (ttl)
+		hdr->flags |= KV_VINDEX_TTL;
+	kv_vindex_update(hdr, (s32)key, present, v);
+	smp_wmb();
+	WRITE_ONCE(hdr->seq, hdr->seq + 1);
+	spin_unlock(&vi->lock);
+}
+
+/* 每次成功修改 @key 之后调用 */
+static inline void kv_vindex_note(struct kv_store *kv, u64 key)
+{
+	struct kv_vindex *vi;
+
+	/* 与 kv_vindex_create() 里发布后的 smp_mb() 配对 */
+	smp_mb();
+	vi = READ_ONCE(kv->vindex);
+	if (vi && key == kv_key((s32)key))
+		kv_vindex_sync(kv, vi, key);
+}
+
+/* kv_vindex_create() 每灌这么多条让出一次 CPU */
+#define KV_VINDEX_WALK_BATCH	1024
+
+/*
+ * 先发布快照再遍历表：遍历开始前完成的修改会被遍历看到，之后的修改
+ * 由修改者自己同步。灌数据期间 KV_VINDEX_POPULATING 让读者未命中时回退。
+ */
+static struct kv_vindex *kv_vindex_create(struct kv_store *kv)
+{
+	struct rhashtable_iter iter;
+	struct kv_vindex *vi, *old;
+	struct my_data *entry;
+	int i;
+
+	vi = kzalloc(sizeof(*vi), GFP_KERNEL_ACCOUNT);
+	if (!vi)
+		return NULL;
+	for (i = 0; i < KV_VINDEX_PAGES; i++) {
+		vi->pages[i] = alloc_page(GFP_KERNEL_ACCOUNT | __GFP_ZERO);
+		if (!vi->pages[i])
+			goto fail;
+	}
+	vi->hdr = vmap(vi->pages, KV_VINDEX_PAGES, VM_MAP, PAGE_KERNEL);
+	if (!vi->hdr)
+		goto fail;
+	vi->hdr->magic = KV_VINDEX_MAGIC;
+	vi->hdr->flags = KV_VINDEX_POPULATING;
+	if (kv_buffered(kv) && !(kv->mode & KV_MODE_EVENTUAL))
+		vi->hdr->flags |= KV_VINDEX_BYPASS;
+	spin_lock_init(&vi->lock);
+
+	old = cmpxchg(&kv->vindex, NULL, vi);
+	if (old) {
+		kv_vindex_free(vi);
+		return old;
+	}
+	smp_mb();
+
+	for (i = 0; i < kv_nr_segs(kv); i++) {
+		struct kv_seg *seg = kv_seg_pin(kv, i);
+		unsigned int n = 0;
+
+		rhashtable_walk_enter(&seg->ht, &iter);
+		rhashtable_walk_start(&iter);
+		while ((entry = rhashtable_walk_next(&iter))) {
+			if (IS_ERR(entry))
+				continue;	/* -EAGAIN：表在扩缩容，接着走 */
+			if (entry->key == kv_key((s32)entry->key))
+				kv_vindex_sync(kv, vi, entry->key);
+			/* 在缺页处理里，大表不能一口气走完 */
+			if (++n % KV_VINDEX_WALK_BATCH == 0) {
+				rhashtable_walk_stop(&iter);
+				cond_resched();
+				rhashtable_walk_start(&iter);
+			}
+		}
+		rhashtable_walk_stop(&iter);
+		rhashtable_walk_exit(&iter);
+		kv_seg_put(seg);
+	}
+
+	spin_lock(&vi->lock);
+	WRITE_ONCE(vi->hdr->seq, vi->hdr->seq + 1);
+	smp_wmb();
+	vi->hdr->flags &= ~KV_VINDEX_POPULATING;
+	smp_wmb();
+	WRITE_ONCE(vi->hdr->seq, vi->hdr->seq + 1);
+	spin_unlock(&vi->lock);
+	return vi;
+fail:
+	kv_vindex_free(vi);
+	return NULL;
+}
+
+/*
+ * [vkv] 映射的缺页处理，返回第 @pgoff 页并持有一个引用。
+ * 映射属于 mm，快照属于线程组；共享 mm 但不同线程组（CLONE_VM 不带
+ * CLONE_THREAD）时，映射的是第一个访问者所在线程组的快照。
+ * 线程组还没有表时不为读者建表，每一页都映射 kv_vindex_empty，
+ * 等 kv_store_install() 清掉页表以后再来。
+ */
+struct page *kv_vindex_page(unsigned long pgoff)
+{
+	struct kv_store *kv;
+	struct kv_vindex *vi;
+	struct page *page;
+
+	if (pgoff >= KV_VINDEX_PAGES)
+		return NULL;
+	kv = kv_store_current();
+	if (!kv) {
+		get_page(kv_vindex_empty);
+		return kv_vindex_empty;
+	}
+	vi = READ_ONCE(kv->vindex);
+	if (!vi)
+		vi = kv_vindex_create(kv);
+	if (!vi)
+		return NULL;
+	page = vi->pages[pgoff];
+	get_page(page);
+	return page;
+}
+
+static inline bool kv_ordered(struct kv_store *kv)
+{
+	return kv->mode & KV_MODE_ORDERED;
+}
+
+/* 有序索引按有符号 64 位比较，v1 的负数键排在正数前面 */
+static void kv_rb_insert(struct kv_store *kv, struct my_data *entry)
+{
+	struct rb_node **link = &kv->ordered.rb_node, *parent = NULL;
+
+	while (*link) {
+		parent = *link;
+		if ((s64)entry->key < (s64)kv_rb_entry(parent)->key)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(kv_rb(entry), parent, link);
+	rb_insert_color(kv_rb(entry), &kv->ordered);
+}
+
+/*
+ * 把填好的 @entry 放进表里：key 不存在就插入，存在就替换旧节点
+ * （@excl 时改为返回 -EEXIST）。
+ * 返回 0 时 @entry 已归表所有，否则仍归调用者。
+ * 调用者持有 kv_fork_lock() 并已对 key 调过 kv_seg_unshare()。
+ */
+static int kv_install(struct kv_store *kv, struct my_data *entry, bool excl)
+{
+	struct my_data *old;
+	int ret;
+
+	/* 有序模式下结构性修改要和红黑树一起改，写者在 ordered_lock 上串行 */
+	if (kv_ordered(kv))
+		kv_spin_lock(kv, &kv->ordered_lock);
+	rcu_read_lock();
+	for (;;) {
+		old = kv_lookup(kv, entry->key);
+		if (old && excl) {
+			ret = -EEXIST;
+			break;
+		}
+		if (!old) {
+			/* 并发插入时可能略微超出上限，超出量不超过并发写者的个数 */
+			if (kv->max_entries &&
+			    kv_nelems(kv) >= kv->max_entries) {
+				ret = -ENOSPC;
+				break;
+			}
+			old = rhashtable_lookup_get_insert_fast(
+						&kv_seg(kv, entry->key)->ht,
+						&entry->node, kv_params);
+			if (!old) {
+				if (kv_ordered(kv))
+					kv_rb_insert(kv, entry);
+				kv_stat_inc(kv, inserts);
+				ret = 0;
+				break;
+			}
+			if (IS_ERR(old)) {
+				ret = PTR_ERR(old);
+				break;
+			}
+			/* 被别的线程抢先插入了同一个 key，改为替换 */
+			kv_stat_inc(kv, contended);
+			if (excl) {
+				ret = -EEXIST;
+				break;
+			}
+		}
+		ret = rhashtable_replace_fast(&kv_seg(kv, entry->key)->ht,
+					      &old->node, &entry->node,
+					      kv_params);
+		if (!ret) {
+			if (kv_ordered(kv))
+				rb_replace_node(kv_rb(old), kv_rb(entry),
+						&kv->ordered);
+			kv_stat_inc(kv, updates);
+			kv_entry_free(old);
+			break;
+		}
+		/* -ENOENT：旧节点刚被别人换掉，重新查 */
+		if (ret != -ENOENT)
+			break;
+		kv_stat_inc(kv, contended);
+	}
+	rcu_read_unlock();
+	if (kv_ordered(kv))
+		spin_unlock(&kv->ordered_lock);
+	return ret;
+}
+
+static void kv_make_room(struct kv_store *kv, u64 key);
+
+static int __kv_set(struct kv_store *kv, u64 key, const void *val, u32 len)
+{
+	struct my_data *entry;
+	int ret;
+
+	ret = kv_seg_unshare(kv, key);
+	if (ret)
+		return ret;
+
+	if (kv_len_word(len)) {
+		rcu_read_lock();
+		entry = kv_lookup(kv, key);
+		if (entry && entry->len == len) {
+			kv_entry_set_word(entry, val);
+			kv_entry_touch(kv, entry);
+			rcu_read_unlock();
+			kv_stat_inc(kv, updates);
+			kv_vindex_note(kv, key);
+			return 0;
+		}
+		rcu_read_unlock();
+	}
+
+	kv_make_room(kv, key);
+	/* 在进入 rhashtable 的桶锁之前分配 */
+	entry = kv_entry_alloc(kv_ordered(kv));
+	if (!entry)
+		return -ENOMEM;
+	ret = kv_entry_fill(entry, key, val, len);
+	if (!ret) {
+		kv_entry_touch(kv, entry);
+		ret = kv_install(kv, entry, false);
+	}
+	if (ret)
+		kv_entry_destroy(entry);
+	else
+		kv_vindex_note(kv, key);
+	return ret;
+}
+
+int kv_set(struct kv_store *kv, u64 key, const void *val, u32 len)
+{
+	u64 t0 = trace_kv_write_enabled() ? ktime_get_ns() : 0;
+	int ret;
+
+	kv_fork_lock(kv);
+	ret = __kv_set(kv, key, val, len);
+	kv_fork_unlock(kv);
+	if (t0)
+		trace_kv_write(key, len, ret, ktime_get_ns() - t0);
+	return ret;
+}
+
+/*
+ * 把值拷进 @buf（容量 @size），*@vlen 返回值的实际长度。
+ * 缓冲区不够时返回 -EMSGSIZE，不拷贝。
+ */
+int kv_get(struct kv_store *kv, u64 key, void *buf, u32 size, u32 *vlen)
+{
+	struct my_data *entry;
+	u64 t0;
+	int ret = -ENOENT;
+
+	if (!kv)
+		return ret;
+	t0 = trace_kv_read_enabled() ? ktime_get_ns() : 0;
+	rcu_read_lock();
+	entry = kv_lookup(kv, key);
+	if (entry && !kv_expired(entry)) {
+		*vlen = entry->len;
+		ret = -EMSGSIZE;
+		if (entry->len <= size) {
+			kv_entry_read(entry, buf);
+			ret = 0;
+		}
+		/* 已经置位就不写，读多的条目不来回弄脏缓存行 */
+		if (!READ_ONCE(entry->referenced))
+			WRITE_ONCE(entry->referenced, 1);
+		kv_stat_inc(kv, hits);
+	} else {
+		kv_stat_inc(kv, misses);
+	}
+	rcu_read_unlock();
+	if (t0)
+		trace_kv_read(key, ret ? 0 : *vlen, ret, ktime_get_ns() - t0);
+	return ret;
+}
+
+/*
+ * 把 @key 从表里摘掉，@expired 时只摘已经过期的。
+ * 调用者持有 kv_fork_lock() 并已对 key 调过 kv_seg_unshare()。
+ */
+static int __kv_del(struct kv_store *kv, u64 key, bool expired)
+{
+	struct my_data *entry;
+	int ret = -ENOENT;
+
+	if (kv_ordered(kv))
+		kv_spin_lock(kv, &kv->ordered_lock);
+	rcu_read_lock();
+	while ((entry = kv_lookup(kv, key))) {
+		if (expired && !kv_expired(entry))
+			break;
+		ret = rhashtable_remove_fast(&kv_seg(kv, key)->ht,
+					     &entry->node, kv_params);
+		if (!ret) {
+			if (kv_ordered(kv))
+				rb_erase(kv_rb(entry), &kv->ordered);
+			kv_entry_free(entry);
+			break;
+		}
+		/* 节点刚被替换或删除，重新查 */
+		kv_stat_inc(kv, contended);
+		ret = -ENOENT;
+	}
+	rcu_read_unlock();
+	if (kv_ordered(kv))
+		spin_unlock(&kv->ordered_lock);
+	if (!ret)
+		kv_vindex_note(kv, key);
+	return ret;
+}
+
+int kv_del(struct kv_store *kv, u64 key)
+{
+	int ret;
+
+	if (!kv)
+		return -ENOENT;
+	kv_fork_lock(kv);
+	ret = kv_seg_unshare(kv, key);
+	if (!ret)
+		ret = __kv_del(kv, key, false);
+	if (!ret)
+		kv_stat_inc(kv, deletes);
+	kv_fork_unlock(kv);
+	return ret;
+}
+
+/*
+ * 过期：读的时候发现过期就当不存在（惰性），真正摘掉交给每个表一个的
+ * delayed_work，每次只沿着游标看 KV_SWEEP_BUDGET 个条目；一批里过期的
+ * 多就马上接着清，否则隔 KV_SWEEP_INTERVAL 再来。
+ *
+ * 按表里的条目数分轮，一轮大约把表看一遍。一整轮都没见到带过期时间的
+ * 条目、其间也没有新写入的，就不再续期，等下一次 kv_ttl_arm()。写者
+ * 读 ttl_fresh 前不加屏障，偶尔会和停下擦肩而过；那样的条目读的时候
+ * 照样算过期，下一次带过期时间的写入重新启动清理时摘掉。
+ */
+#define KV_SWEEP_BUDGET		1024
+
+struct kv_sweep {
+	unsigned int nr;
+	unsigned int seen;		/* 看了多少个条目 */
+	bool timed;			/* 其中有带过期时间的 */
+	u64 keys[64];
+};
+
+static bool kv_sweep_pick(struct my_data *entry, void *arg)
+{
+	struct kv_sweep *s = arg;
+
+	s->seen++;
+	if (READ_ONCE(entry->expires))
+		s->timed = true;
+	if (kv_expired(entry))
+		s->keys[s->nr++] = entry->key;
+	return s->nr == ARRAY_SIZE(s->keys);
+}
+
+static void kv_expire_work(struct work_struct *work)
+{
+	struct kv_store *kv = container_of(to_delayed_work(work),
+					   struct kv_store, expire_work);
+	struct kv_sweep s = { .nr = 0 };
+	unsigned int i;
+
+	/* 新一轮：先清 ttl_fresh 再看表，之后的写入会重新置上 */
+	if (!kv->sweep_left) {
+		kv->sweep_left = max_t(unsigned long, kv_nelems(kv), 1);
+		kv->sweep_timed = false;
+		WRITE_ONCE(kv->ttl_fresh, false);
+		smp_mb();
+	}
+	kv_cursor_scan(kv, &kv->sweep, KV_SWEEP_BUDGET, kv_sweep_pick, &s);
+	kv->sweep_left -= min_t(unsigned long, s.seen ?: 1, kv->sweep_left);
+	kv->sweep_timed |= s.timed;
+	kv_fork_lock(kv);
+	for (i = 0; i < s.nr; i++) {
+		if (kv_seg_unshare(kv, s.keys[i]))
+			break;
+		if (!__kv_del(kv, s.keys[i], true))
+			kv_stat_inc(kv, expired);
+	}
+	kv_fork_unlock(kv);
+
+	if (!kv->sweep_left && !kv->sweep_timed && !READ_ONCE(kv->ttl_fresh))
+		return;
+	schedule_delayed_work(&kv->expire_work,
+			      s.nr == ARRAY_SIZE(s.keys) ? 1 : KV_SWEEP_INTERVAL);
+}
+
+/* 给已有的键设置过期时间，@ttl_ms 为 0 时取消 */
+int kv_expire(struct kv_store *kv, u64 key, unsigned int ttl_ms)
+{
+	struct my_data *entry;
+	int ret;
+
+	if (!kv)
+		return -ENOENT;
+	kv_fork_lock(kv);
+	ret = kv_seg_unshare(kv, key);
+	if (ret)
+		goto out;
+	ret = -ENOENT;
+	rcu_read_lock();
+	entry = kv_lookup(kv, key);
+	if (entry && !kv_expired(entry)) {
+		WRITE_ONCE(entry->expires, kv_ttl_deadline(ttl_ms));
+		ret = 0;
+	}
+	rcu_read_unlock();
+	if (!ret) {
+		if (ttl_ms)
+			kv_ttl_arm(kv);
+		kv_vindex_note(kv, key);
+	}
+out:
+	kv_fork_unlock(kv);
+	return ret;
+}
+
+/*
+ * 容量满时的 CLOCK 淘汰：指针（kv->hand）绕表转，访问位为 1 的清零放过，
+ * 遇到为 0 或已经过期的就选中。两圈之内一定能选出一个。
+ */
+struct kv_victim {
+	u64 key;
+	bool found;
+};
+
+static bool kv_evict_pick(struct my_data *entry, void *arg)
+{
+	struct kv_victim *v = arg;
+
+	if (kv_expired(entry) || !READ_ONCE(entry->referenced)) {
+		v->key = entry->key;
+		v->found = true;
+		return true;
+	}
+	WRITE_ONCE(entry->referenced, 0);
+	return false;
+}
+
+/*
+ * 插入新键之前调用，条目数到了 kv->capacity 就先淘汰。并发的插入者
+ * 可能让条目数略微超出容量，与 max_entries 的处理一致。
+ * 调用者持有 kv_fork_lock()。
+ */
+static void kv_make_room(struct kv_store *kv, u64 key)
+{
+	unsigned int cap = READ_ONCE(kv->capacity);
+	struct kv_victim v;
+	bool exists;
+	int tries;
+
+	if (likely(!cap) || kv_nelems(kv) < cap)
+		return;
+	/* 覆盖已有的键不增加条目数 */
+	rcu_read_lock();
+	exists = kv_lookup(kv, key);
+	rcu_read_unlock();
+	if (exists)
+		return;
+
+	mutex_lock(&kv->evict_lock);
+	for (tries = 0; tries < 8 && kv_nelems(kv) >= cap; tries++) {
+		v.found = false;
+		kv_cursor_scan(kv, &kv->hand, 2 * kv_nelems(kv) + 1,
+			       kv_evict_pick, &v);
+		if (!v.found)
+			break;
+		if (!kv_seg_unshare(kv, v.key) && !__kv_del(kv, v.key, false))
+			kv_stat_inc(kv, evictions);
+	}
+	mutex_unlock(&kv->evict_lock);
+}
+
+/* 4 字节的值按 s32 参与运算，结果符号扩展到 64 位 */
+static inline u64 kv_word_val(u32 len, u64 word)
+{
+	return len == sizeof(s32) ? (u64)(s64)(s32)word : word;
+}
+
+static inline u64 kv_word_make(u32 len, u64 val)
+{
+	return len == sizeof(s32) ? (u32)val : val;
+}
+
+enum kv_rmw_op {
+	KV_RMW_ADD,
+	KV_RMW_CAS,
 };
 
-SYSCALL_DEFINE2(write_kv, int, k, int, v)
+/*
+ * 在条目的值字上做 cmpxchg 循环，不拿任何锁；与原地更新的写者、
+ * 其它 RMW 之间都是原子的。节点被替换或删除时，先完成的 RMW 视为
+ * 排在替换之前。
+ */
+static int kv_rmw(struct kv_store *kv, u64 key, enum kv_rmw_op op, u64 arg,
+		  u64 expected, u64 *old)
+{
+	struct my_data *entry;
+	u64 word, prev, cur;
+	int ret;
+
+	kv_fork_lock(kv);
+	ret = kv_seg_unshare(kv, key);
+	if (ret)
+		goto out;
+retry:
+	rcu_read_lock();
+	entry = kv_lookup(kv, key);
+	if (entry && kv_expired(entry)) {
+		/* 先把过期的摘掉，再按不存在处理 */
+		rcu_read_unlock();
+		__kv_del(kv, key, true);
+		goto retry;
+	}
+	if (!entry) {
+		rcu_read_unlock();
+		kv_stat_inc(kv, misses);
+		ret = -ENOENT;
+		if (op != KV_RMW_ADD)
+			goto out;
+		/* 不存在的键按 0 处理，新建一个 8 字节的值 */
+		kv_make_room(kv, key);
+		entry = kv_entry_alloc(kv_ordered(kv));
+		ret = -ENOMEM;
+		if (!entry)
+			goto out;
+		kv_entry_fill(entry, key, &arg, sizeof(arg));
+		kv_entry_touch(kv, entry);
+		ret = kv_install(kv, entry, true);
+		if (ret) {
+			kv_entry_destroy(entry);
+			if (ret == -EEXIST)
+				goto retry;
+			goto out;
+		}
+		*old = 0;
+		goto note;
+	}
+	kv_stat_inc(kv, hits);
+	ret = -EINVAL;
+	if (entry->len != sizeof(s32) && entry->len != sizeof(s64)) {
+		rcu_read_unlock();
+		goto out;
+	}
+	if (op == KV_RMW_CAS)
+		expected = kv_word_val(entry->len, expected);
+	word = READ_ONCE(entry->word);
+	for (;;) {
+		cur = kv_word_val(entry->len, word);
+		if (op == KV_RMW_CAS && cur != expected) {
+			*old = cur;
+			ret = -EAGAIN;
+			break;
+		}
+		prev = cmpxchg64(&entry->word, word,
+				 kv_word_make(entry->len, op == KV_RMW_ADD ?
+						  cur + arg : arg));
+		if (prev == word) {
+			*old = cur;
+			ret = 0;
+			break;
+		}
+		kv_stat_inc(kv, contended);
+		word = prev;
+	}
+	rcu_read_unlock();
+	if (ret)
+		goto out;
+	kv_stat_inc(kv, updates);
+note:
+	kv_vindex_note(kv, key);
+out:
+	kv_fork_unlock(kv);
+	return ret;
+}
+
+/* 把 @key 的值加上 @delta，*@old 返回加之前的值；键不存在时从 0 开始 */
+int kv_fetch_add(struct kv_store *kv, u64 key, s64 delta, s64 *old)
+{
+	return kv_rmw(kv, key, KV_RMW_ADD, delta, 0, (u64 *)old);
+}
+
+/*
+ * 值等于 @expected 时换成 @desired 并返回 0，否则返回 -EAGAIN。
+ * 两种情况下 *@actual 都是比较时的值。
+ */
+int kv_cas(struct kv_store *kv, u64 key, u64 expected, u64 desired,
+	   u64 *actual)
 {
-	int hash = k & 0x3FF;
-	struct my_data *new_data;
-	// printk(KERN_INFO "write_kv: k=%d, v=%d, hash=%d\n", k, v, hash);
+	if (!kv)
+		return -ENOENT;
+	return kv_rmw(kv, key, KV_RMW_CAS, desired, expected, actual);
+}
 
-	spin_lock(&current->kv_store_lock[hash]);
-	hlist_for_each_entry (new_data, &current->kv_store[hash], node) {
-		if (new_data->key == k) {
-			new_data->value = v;
-			spin_unlock(&current->kv_store_lock[hash]);
+/*
+ * 系统调用的写入口。KV_MODE_BUFFERED 下短值进本线程的缓冲区；其它写入
+ * 先把缓冲区刷掉，本线程的写入仍按调用顺序生效。
+ */
+static int kv_write(struct kv_store *kv, u64 key, const void *val, u32 len)
+{
+	if (kv_buffered(kv)) {
+		if (kv_wbuf_put(kv, key, val, len))
 			return 0;
+		kv_wbuf_flush_current(false);
+	}
+	return kv_set(kv, key, val, len);
+}
+
+/* 系统调用的读入口，读己之写：先查本线程的缓冲区 */
+static int kv_read(struct kv_store *kv, u64 key, void *buf, u32 size,
+		   u32 *vlen)
+{
+	int ret;
+
+	if (kv_buffered(kv) && !(kv->mode & KV_MODE_EVENTUAL)) {
+		ret = kv_wbuf_get(kv, key, buf, size, vlen);
+		if (ret != -ENOENT)
+			return ret;
+	}
+	return kv_get(kv, key, buf, size, vlen);
+}
+
+/* 表之外的操作（删除、扫描、批量写）前调用，让它们排在本线程之前的写入之后 */
+static inline void kv_write_barrier(struct kv_store *kv)
+{
+	if (kv_buffered(kv))
+		kv_wbuf_flush_current(false);
+}
+
+/* v1 只认 4 字节的值，其它长度的值对 read_kv 来说等于不存在 */
+static int kv_get_int(struct kv_store *kv, int k, int *v)
+{
+	u32 vlen;
+	int ret;
+
+	ret = kv_read(kv, kv_key(k), v, sizeof(*v), &vlen);
+	if (ret == -EMSGSIZE || (!ret && vlen != sizeof(*v)))
+		ret = -ENOENT;
+	return ret;
+}
+
+SYSCALL_DEFINE2(write_kv, int, k, int, v)
+{
+	struct kv_store *kv = kv_store_get_or_create();
+
+	if (!kv)
+		return -ENOMEM;
+	return kv_write(kv, kv_key(k), &v, sizeof(v));
+}
+
+SYSCALL_DEFINE1(read_kv, int, k)
+{
+	struct kv_store *kv = kv_store_current();
+	int v;
+
+	/* 本线程缓冲区里的值表里可能还没有，先查再判断表是否为空 */
+	if (!kv_get_int(kv, k, &v))
+		return v;
+	if (!kv || !kv_nelems(kv))
+		return -3;	/* 表为空 */
+	return -2;
+}
+
+/*
+ * v2 接口：64 位键，值最长 KV_VALUE_MAX 字节，错误只通过返回值给出。
+ */
+SYSCALL_DEFINE3(kv_put, __u64, key, const void __user *, val, __u32, len)
+{
+	struct kv_store *kv;
+	u8 small[KV_INLINE_SIZE];
+	void *kbuf = small;
+	int ret;
+
+	if (len > KV_VALUE_MAX)
+		return -E2BIG;
+	if (len > sizeof(small)) {
+		kbuf = kmalloc(len, GFP_KERNEL);
+		if (!kbuf)
+			return -ENOMEM;
+	}
+	ret = -EFAULT;
+	if (copy_from_user(kbuf, val, len))
+		goto out;
+	ret = -ENOMEM;
+	kv = kv_store_get_or_create();
+	if (kv)
+		ret = kv_write(kv, key, kbuf, len);
+out:
+	if (kbuf != small)
+		kfree(kbuf);
+	return ret;
+}
+
+/*
+ * 命中返回 0，值拷进 @buf；不存在返回 -ENOENT；@len 不够返回 -EMSGSIZE。
+ * 只有返回 0 和 -EMSGSIZE 时 *@out_len 才写回值的实际长度，可以先传
+ * len=0 探测大小。
+ */
+SYSCALL_DEFINE4(kv_get, __u64, key, void __user *, buf, __u32, len,
+		__u32 __user *, out_len)
+{
+	u8 small[KV_INLINE_SIZE];
+	void *kbuf = small;
+	u32 size, vlen = 0;
+	int ret;
+
+	size = min_t(u32, len, KV_VALUE_MAX);
+	if (size > sizeof(small)) {
+		kbuf = kmalloc(size, GFP_KERNEL);
+		if (!kbuf)
+			return -ENOMEM;
+	}
+	ret = kv_read(kv_store_current(), key, kbuf, size, &vlen);
+	if (!ret && copy_to_user(buf, kbuf, vlen))
+		ret = -EFAULT;
+	if ((!ret || ret == -EMSGSIZE) && out_len && put_user(vlen, out_len))
+		ret = -EFAULT;
+	if (kbuf != small)
+		kfree(kbuf);
+	return ret;
+}
+
+/* 批量接口每次从用户态拷入这么多条记录 */
+#define KV_BATCH_CHUNK 256
+
+/*
+ * 先在 RCU 下把已存在的 int 值原地更新，只给其余记录一次性从 slab
+ * 批量取节点，再逐个插入。rhashtable 的桶锁在插入内部获取，不再需要
+ * 按桶分组加锁；同一个 key 的多次写入按数组中的先后顺序生效。
+ */
+/* 调用者持有 kv_fork_lock() */
+static int kv_write_batch_chunk(struct kv_store *kv,
+				struct kv_batch_entry *ents, void **objs,
+				unsigned int n)
+{
+	struct my_data *entry;
+	unsigned int i, misses = 0, got, used = 0;
+	int done = 0;
+
+	for (i = 0; i < n; i++) {
+		ents[i].status = kv_seg_unshare(kv, kv_key(ents[i].key));
+		if (ents[i].status)
+			continue;
+		rcu_read_lock();
+		entry = kv_lookup(kv, kv_key(ents[i].key));
+		if (entry && entry->len == sizeof(ents[i].value)) {
+			kv_entry_set_word(entry, &ents[i].value);
+			kv_entry_touch(kv, entry);
+			kv_stat_inc(kv, updates);
+			ents[i].status = 0;
+			done++;
+		} else {
+			ents[i].status = -ENOENT;
+			misses++;
+		}
+		rcu_read_unlock();
+		if (!ents[i].status)
+			kv_vindex_note(kv, kv_key(ents[i].key));
+	}
+	if (!misses)
+		return done;
+
+	got = kmem_cache_alloc_bulk(kv_entry_cache(kv_ordered(kv)), GFP_KERNEL,
+				    misses, objs);
+	for (i = 0; i < n; i++) {
+		int ret;
+
+		if (ents[i].status != -ENOENT)
+			continue;
+		if (used == got) {
+			ents[i].status = -ENOMEM;
+			continue;
+		}
+		kv_make_room(kv, kv_key(ents[i].key));
+		entry = objs[used];
+		entry->ordered = kv_ordered(kv);
+		kv_entry_fill(entry, kv_key(ents[i].key), &ents[i].value,
+			      sizeof(ents[i].value));
+		kv_entry_touch(kv, entry);
+		ret = kv_install(kv, entry, false);
+		if (!ret) {
+			used++;		/* 节点已被表接管 */
+			done++;
+			kv_vindex_note(kv, kv_key(ents[i].key));
+		}
+		ents[i].status = ret;
+	}
+	if (used < got)
+		kmem_cache_free_bulk(kv_entry_cache(kv_ordered(kv)), got - used,
+				     objs + used);
+	return done;
+}
+
+static int kv_read_batch_chunk(struct kv_store *kv,
+			       struct kv_batch_entry *ents, unsigned int n)
+{
+	unsigned int i;
+	int done = 0;
+
+	for (i = 0; i < n; i++) {
+		struct kv_batch_entry *e = &ents[i];
+
+		e->status = kv_get_int(kv, e->key, &e->value);
+		if (!e->status)
+			done++;
+	}
+	return done;
+}
+
+/*
+ * 一次陷入处理整个数组：分块拷入内核、处理、再把 value/status 拷回。
+ * 返回成功的记录数；拷贝失败返回 -EFAULT，此前的块已经生效。
+ */
+static long kv_batch(struct kv_batch_entry __user *uents, unsigned int nr,
+		     bool write)
+{
+	struct kv_store *kv;
+	struct kv_batch_entry *ents;
+	void **objs = NULL;
+	unsigned int off, n;
+	long done = 0;
+	int ret = 0;
+
+	if (!nr)
+		return 0;
+
+	kv = write ? kv_store_get_or_create() : kv_store_current();
+	if (write && !kv)
+		return -ENOMEM;
+	if (write)
+		kv_write_barrier(kv);
+
+	ents = kmalloc_array(KV_BATCH_CHUNK, sizeof(*ents), GFP_KERNEL);
+	if (write)
+		objs = kmalloc_array(KV_BATCH_CHUNK, sizeof(*objs), GFP_KERNEL);
+	if (!ents || (write && !objs)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (off = 0; off < nr; off += n) {
+		n = min_t(unsigned int, nr - off, KV_BATCH_CHUNK);
+		if (copy_from_user(ents, uents + off, n * sizeof(*ents))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (write) {
+			kv_fork_lock(kv);
+			done += kv_write_batch_chunk(kv, ents, objs, n);
+			kv_fork_unlock(kv);
+		} else
+			done += kv_read_batch_chunk(kv, ents, n);
+		if (copy_to_user(uents + off, ents, n * sizeof(*ents))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+out:
+	kfree(objs);
+	kfree(ents);
+	return ret ? ret : done;
+}
+
+SYSCALL_DEFINE2(write_kv_batch, struct kv_batch_entry __user *, entries,
+		unsigned int, nr)
+{
+	return kv_batch(entries, nr, true);
+}
+
+SYSCALL_DEFINE2(read_kv_batch, struct kv_batch_entry __user *, entries,
+		unsigned int, nr)
+{
+	return kv_batch(entries, nr, false);
+}
+
+/*
+ * @ttl_ms 毫秒后 @key 过期，0 表示取消过期时间。键不存在返回 -ENOENT。
+ * 之后再写这个键会按默认 TTL（KV_CTL_SET_TTL）重新计算。
+ */
+SYSCALL_DEFINE2(kv_expire, __u64, key, __u32, ttl_ms)
+{
+	struct kv_store *kv = kv_store_current();
+
+	kv_write_barrier(kv);
+	return kv_expire(kv, key, ttl_ms);
+}
+
+SYSCALL_DEFINE1(delete_kv, __u64, key)
+{
+	struct kv_store *kv = kv_store_current();
+
+	kv_write_barrier(kv);
+	return kv_del(kv, key);
+}
+
+/*
+ * 计数器：4 或 8 字节的值原子地加 @delta，*@old 返回旧值（可为 NULL）。
+ * 键不存在时按 0 新建一个 8 字节的值。其它长度的值返回 -EINVAL。
+ */
+SYSCALL_DEFINE3(kv_fetch_add, __u64, key, __s64, delta, __s64 __user *, old)
+{
+	struct kv_store *kv = kv_store_get_or_create();
+	s64 prev;
+	int ret;
+
+	if (!kv)
+		return -ENOMEM;
+	kv_write_barrier(kv);
+	ret = kv_fetch_add(kv, key, delta, &prev);
+	if (!ret && old && put_user(prev, old))
+		ret = -EFAULT;
+	return ret;
+}
+
+/*
+ * 比较并交换：成功返回 0，值不等于 @expected 返回 -EAGAIN，键不存在
+ * 返回 -ENOENT。前两种情况下 *@actual（可为 NULL）写回比较时的值。
+ * 4 字节的值只看 @expected/@desired 的低 32 位。
+ */
+SYSCALL_DEFINE4(kv_cas, __u64, key, __u64, expected, __u64, desired,
+		__u64 __user *, actual)
+{
+	struct kv_store *kv = kv_store_current();
+	u64 cur;
+	int ret;
+
+	kv_write_barrier(kv);
+	ret = kv_cas(kv, key, expected, desired, &cur);
+	if ((!ret || ret == -EAGAIN) && actual && put_user(cur, actual))
+		ret = -EFAULT;
+	return ret;
+}
+
+static void kv_scan_fill(struct kv_scan_entry *e, const struct my_data *entry)
+{
+	e->key = entry->key;
+	e->len = entry->len;
+	e->resv = 0;
+	e->value = kv_len_word(entry->len) ? READ_ONCE(entry->word) : 0;
+}
+
+/* 有序模式：在红黑树上找到第一个 >= @start 的节点，顺着往后取 */
+static unsigned int kv_scan_ordered(struct kv_store *kv, s64 start,
+				    struct kv_scan_entry *ents, unsigned int n)
+{
+	struct rb_node *node, *first = NULL;
+	unsigned int cnt = 0;
+
+	spin_lock(&kv->ordered_lock);
+	node = kv->ordered.rb_node;
+	while (node) {
+		if ((s64)kv_rb_entry(node)->key >= start) {
+			first = node;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	for (node = first; node && cnt < n; node = rb_next(node)) {
+		struct my_data *entry = kv_rb_entry(node);
+
+		if (!kv_expired(entry))
+			kv_scan_fill(&ents[cnt++], entry);
+	}
+	spin_unlock(&kv->ordered_lock);
+	return cnt;
+}
+
+static void kv_scan_sift_down(struct kv_scan_entry *heap, unsigned int cnt,
+			      unsigned int i)
+{
+	for (;;) {
+		unsigned int l = 2 * i + 1, r = l + 1, max = i;
+
+		if (l < cnt && (s64)heap[l].key > (s64)heap[max].key)
+			max = l;
+		if (r < cnt && (s64)heap[r].key > (s64)heap[max].key)
+			max = r;
+		if (max == i)
+			return;
+		swap(heap[i], heap[max]);
+		i = max;
+	}
+}
+
+static void kv_scan_sift_up(struct kv_scan_entry *heap, unsigned int i)
+{
+	while (i) {
+		unsigned int parent = (i - 1) / 2;
+
+		if ((s64)heap[parent].key >= (s64)heap[i].key)
+			return;
+		swap(heap[i], heap[parent]);
+		i = parent;
+	}
+}
+
+static int kv_scan_cmp(const void *a, const void *b)
+{
+	s64 ka = ((const struct kv_scan_entry *)a)->key;
+	s64 kb = ((const struct kv_scan_entry *)b)->key;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+/* kv_scan_walk() 每走这么多条让出一次 CPU */
+#define KV_SCAN_WALK_BATCH	1024
+
+/*
+ * 无序模式：遍历整张表，用大小为 @n 的最大堆留下 >= @start 的最小
+ * @n 个键，最后排序。扩缩容时遍历可能重复看到同一个节点，排序后去重。
+ */
+static unsigned int kv_scan_walk(struct kv_store *kv, s64 start,
+				 struct kv_scan_entry *ents, unsigned int n)
+{
+	struct rhashtable_iter iter;
+	struct my_data *entry;
+	unsigned int cnt = 0, i, out;
+
+	for (i = 0; i < kv_nr_segs(kv); i++) {
+		struct kv_seg *seg = kv_seg_pin(kv, i);
+		unsigned int seen = 0;
+
+		rhashtable_walk_enter(&seg->ht, &iter);
+		rhashtable_walk_start(&iter);
+		for (;;) {
+			/* 每次调用都要走完整个段，大表不能一口气走完 */
+			if (seen && seen % KV_SCAN_WALK_BATCH == 0) {
+				rhashtable_walk_stop(&iter);
+				cond_resched();
+				rhashtable_walk_start(&iter);
+			}
+			entry = rhashtable_walk_next(&iter);
+			if (!entry)
+				break;
+			seen++;
+			if (IS_ERR(entry))
+				continue;
+			if ((s64)entry->key < start || kv_expired(entry))
+				continue;
+			if (cnt < n) {
+				kv_scan_fill(&ents[cnt], entry);
+				kv_scan_sift_up(ents, cnt++);
+			} else if ((s64)entry->key < (s64)ents[0].key) {
+				kv_scan_fill(&ents[0], entry);
+				kv_scan_sift_down(ents, cnt, 0);
+			}
 		}
+		rhashtable_walk_stop(&iter);
+		rhashtable_walk_exit(&iter);
+		kv_seg_put(seg);
+	}
+
+	sort(ents, cnt, sizeof(*ents), kv_scan_cmp, NULL);
+	for (i = 0, out = 0; i < cnt; i++)
+		if (!out || ents[i].key != ents[out - 1].key)
+			ents[out++] = ents[i];
+	return out;
+}
+
+/*
+ * 按键（有符号 64 位）升序返回最多 @n 个 >= @start 的条目，返回条数，
+ * 0 表示扫完了。下一次从最后一个键加一开始。
+ * 不超过 8 字节的值直接带回，更长的值需要再 kv_get。
+ */
+SYSCALL_DEFINE3(scan_kv, __s64, start, struct kv_scan_entry __user *, buf,
+		unsigned int, n)
+{
+	struct kv_store *kv = kv_store_current();
+	struct kv_scan_entry *ents;
+	unsigned int cnt;
+	long ret;
+
+	if (!kv || !n)
+		return 0;
+	kv_write_barrier(kv);
+	n = min_t(unsigned int, n, KV_SCAN_MAX);
+	ents = kmalloc_array(n, sizeof(*ents), GFP_KERNEL);
+	if (!ents)
+		return -ENOMEM;
+	if (kv_ordered(kv))
+		cnt = kv_scan_ordered(kv, start, ents, n);
+	else
+		cnt = kv_scan_walk(kv, start, ents, n);
+	ret = cnt;
+	if (copy_to_user(buf, ents, cnt * sizeof(*ents)))
+		ret = -EFAULT;
+	kfree(ents);
+	return ret;
+}
+
+/*
+ * kv_dump/kv_load：格式见 uapi 头文件。读写都经过一个 KV_DUMP_CHUNK
+ * 大小的缓冲区，每次整块 kernel_write/kernel_read。
+ */
+#define KV_DUMP_CHUNK	(64 << 10)
+
+struct kv_dump_io {
+	struct file *file;
+	loff_t *ppos;			/* FMODE_STREAM 的文件为 NULL */
+	char *buf;
+	size_t len;			/* 写：缓冲区里的字节数；读：有效字节数 */
+	size_t off;			/* 读：已经消费的字节数 */
+	u32 crc;
+};
+
+static int kv_dump_flush(struct kv_dump_io *io)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < io->len) {
+		n = kernel_write(io->file, io->buf + done, io->len - done,
+				 io->ppos);
+		if (n < 0)
+			return n;
+		if (!n)
+			return -EIO;
+		done += n;
 	}
-	new_data = kmalloc(sizeof(struct my_data), GFP_KERNEL);
-    if (!new_data) {
-        printk(KERN_ERR "write_kv: kmalloc failed for key=%d\n", k);
-        spin_unlock(&current->kv_store_lock[hash]);
-        return -ENOMEM;
-    }
-	new_data->key = k;
-	new_data->value = v;
-	hlist_add_head(&new_data->node, &current->kv_store[hash]);
-	spin_unlock(&current->kv_store_lock[hash]);
+	io->len = 0;
 	return 0;
 }
 
-SYSCALL_DEFINE1(read_kv, int, k)
+/* 调用者保证缓冲区放得下 */
+static void kv_dump_put(struct kv_dump_io *io, const void *p, size_t n)
+{
+	memcpy(io->buf + io->len, p, n);
+	io->crc = crc32_le(io->crc, p, n);
+	io->len += n;
+}
+
+/*
+ * 遍历不是快照：与之并发的修改可能写进去也可能没有，扩缩容时同一个
+ * 条目可能出现两次（加载时后者覆盖前者，值相同）。
+ */
+static long kv_dump(struct kv_store *kv, struct kv_dump_io *io)
+{
+	struct kv_dump_hdr hdr = {
+		.magic		= cpu_to_le32(KV_DUMP_MAGIC),
+		.version	= cpu_to_le32(KV_DUMP_VERSION),
+	};
+	struct rhashtable_iter iter;
+	struct kv_dump_rec rec;
+	struct my_data *entry;
+	unsigned int i;
+	__le32 crc;
+	long nr = 0;
+	int ret = 0;
+
+	kv_dump_put(io, &hdr, sizeof(hdr));
+	for (i = 0; kv && i < kv_nr_segs(kv) && !ret; i++) {
+		struct kv_seg *seg = kv_seg_pin(kv, i);
+
+		rhashtable_walk_enter(&seg->ht, &iter);
+		rhashtable_walk_start(&iter);
+		for (;;) {
+			/* 留够一条最长记录的空间，写文件时暂停遍历 */
+			if (KV_DUMP_CHUNK - io->len < sizeof(rec) + KV_VALUE_MAX) {
+				rhashtable_walk_stop(&iter);
+				ret = kv_dump_flush(io);
+				if (!ret && fatal_signal_pending(current))
+					ret = -EINTR;
+				cond_resched();
+				rhashtable_walk_start(&iter);
+				if (ret)
+					break;
+			}
+			entry = rhashtable_walk_next(&iter);
+			if (!entry)
+				break;
+			if (IS_ERR(entry))
+				continue;	/* -EAGAIN：表在扩缩容，接着走 */
+			if (kv_expired(entry))
+				continue;
+			rec.key = cpu_to_le64(entry->key);
+			rec.len = cpu_to_le32(entry->len);
+			kv_dump_put(io, &rec, sizeof(rec));
+			kv_entry_read(entry, io->buf + io->len);
+			io->crc = crc32_le(io->crc, io->buf + io->len, entry->len);
+			io->len += entry->len;
+			nr++;
+		}
+		rhashtable_walk_stop(&iter);
+		rhashtable_walk_exit(&iter);
+		kv_seg_put(seg);
+	}
+	if (ret)
+		return ret;
+
+	rec.key = cpu_to_le64(nr);
+	rec.len = cpu_to_le32(KV_DUMP_END);
+	kv_dump_put(io, &rec, sizeof(rec));
+	crc = cpu_to_le32(io->crc);
+	memcpy(io->buf + io->len, &crc, sizeof(crc));
+	io->len += sizeof(crc);
+	ret = kv_dump_flush(io);
+	return ret ? ret : nr;
+}
+
+static int kv_load_read(struct kv_dump_io *io, void *dst, size_t n)
+{
+	ssize_t got;
+	size_t c;
+
+	while (n) {
+		if (io->off == io->len) {
+			/*
+			 * 普通文件整块读，多读的部分最后退回去；流退不回去，
+			 * 只读这次要的，转储后面的数据留给调用者。
+			 */
+			size_t want = io->ppos ? KV_DUMP_CHUNK :
+					min_t(size_t, n, KV_DUMP_CHUNK);
+
+			got = kernel_read(io->file, io->buf, want, io->ppos);
+			if (got < 0)
+				return got;
+			if (!got)
+				return -EBADMSG;	/* 文件被截断 */
+			io->len = got;
+			io->off = 0;
+			if (fatal_signal_pending(current))
+				return -EINTR;
+		}
+		c = min(n, io->len - io->off);
+		memcpy(dst, io->buf + io->off, c);
+		io->crc = crc32_le(io->crc, dst, c);
+		io->off += c;
+		dst += c;
+		n -= c;
+	}
+	return 0;
+}
+
+/* 校验通过之前读到的条目先放在这里，不碰表 */
+struct kv_load_stage {
+	struct my_data **ents;
+	size_t nr, cap;
+};
+
+static int kv_load_stage_add(struct kv_load_stage *st, struct my_data *entry)
+{
+	struct my_data **ents;
+
+	if (st->nr == st->cap) {
+		size_t cap = st->cap ? st->cap * 2 : 1024;
+
+		ents = kvmalloc_array(cap, sizeof(*ents), GFP_KERNEL_ACCOUNT);
+		if (!ents)
+			return -ENOMEM;
+		if (st->nr)
+			memcpy(ents, st->ents, st->nr * sizeof(*ents));
+		kvfree(st->ents);
+		st->ents = ents;
+		st->cap = cap;
+	}
+	st->ents[st->nr++] = entry;
+	return 0;
+}
+
+static int kv_load_parse(struct kv_dump_io *io, struct kv_load_stage *st,
+			 bool ordered)
 {
-	int hash = k & 0x3FF;
 	struct my_data *entry;
-	int v = -2;
-	// printk(KERN_INFO "read_kv: k=%d\n", k);
-	spin_lock(&current->kv_store_lock[hash]);
-    // printk(KERN_INFO "check1\n");
-    if(hlist_empty(&current->kv_store[hash])){
-        spin_unlock(&current->kv_store_lock[hash]);
-        printk(KERN_INFO "when k = %d, hash = %d, table is empty\n",k,hash);
-		v=-3;
-		return -3;
-    }
-	hlist_for_each_entry (entry, &current->kv_store[hash], node) {
-        // printk(KERN_INFO "check2\n");
-		if (entry->key == k) {
-			v = entry->value;
-			// printk(KERN_INFO "read_kv: v=%d\n", v);
-			break;
-		}
-	}
-	spin_unlock(&current->kv_store_lock[hash]);
-	return v;
-}
\ No newline at end of file
+	struct kv_dump_hdr hdr;
+	struct kv_dump_rec rec;
+	void *val;
+	__le32 crc;
+	u32 len, sum;
+	int ret;
+
+	ret = kv_load_read(io, &hdr, sizeof(hdr));
+	if (ret)
+		return ret;
+	if (le32_to_cpu(hdr.magic) != KV_DUMP_MAGIC ||
+	    le32_to_cpu(hdr.version) != KV_DUMP_VERSION)
+		return -EINVAL;
+
+	val = kmalloc(KV_VALUE_MAX, GFP_KERNEL);
+	if (!val)
+		return -ENOMEM;
+	for (;;) {
+		ret = kv_load_read(io, &rec, sizeof(rec));
+		if (ret)
+			break;
+		len = le32_to_cpu(rec.len);
+		if (len == KV_DUMP_END)
+			break;
+		ret = -EBADMSG;
+		if (len > KV_VALUE_MAX)
+			break;
+		ret = kv_load_read(io, val, len);
+		if (ret)
+			break;
+		ret = -ENOMEM;
+		entry = kv_entry_alloc(ordered);
+		if (!entry)
+			break;
+		ret = kv_entry_fill(entry, le64_to_cpu(rec.key), val, len);
+		if (!ret)
+			ret = kv_load_stage_add(st, entry);
+		if (ret) {
+			kv_entry_destroy(entry);
+			break;
+		}
+	}
+	kfree(val);
+	if (ret)
+		return ret;
+
+	/* 结束记录的 key 是条数，之后的校验和不计入自身 */
+	sum = io->crc;
+	ret = kv_load_read(io, &crc, sizeof(crc));
+	if (ret)
+		return ret;
+	if (le64_to_cpu(rec.key) != st->nr || le32_to_cpu(crc) != sum)
+		return -EBADMSG;
+	return 0;
+}
+
+/*
+ * 整个文件读完、校验通过才开始往表里放，坏文件不会留下半张表。
+ * 已有的同名键被覆盖。转储里不带过期时间，读进来的条目按默认 TTL 处理。放的过程中出错（如超出 kv_max_entries）时
+ * 之前的条目已经生效。
+ */
+static long kv_load(struct kv_store *kv, struct kv_dump_io *io)
+{
+	struct kv_load_stage st = { };
+	size_t i = 0;
+	long ret;
+
+	ret = kv_load_parse(io, &st, kv_ordered(kv));
+	if (ret)
+		goto out;
+
+	kv_fork_lock(kv);
+	for (; i < st.nr; i++) {
+		struct my_data *entry = st.ents[i];
+
+		ret = kv_seg_unshare(kv, entry->key);
+		if (ret)
+			break;
+		kv_make_room(kv, entry->key);
+		kv_entry_touch(kv, entry);
+		ret = kv_install(kv, entry, false);
+		if (ret)
+			break;
+		kv_vindex_note(kv, entry->key);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	kv_fork_unlock(kv);
+	if (!ret)
+		ret = st.nr;
+out:
+	for (; i < st.nr; i++)
+		kv_entry_destroy(st.ents[i]);
+	kvfree(st.ents);
+	return ret;
+}
+
+static long kv_dump_fd(unsigned int fd, bool load)
+{
+	struct kv_dump_io io = { };
+	struct kv_store *kv;
+	struct fd f;
+	loff_t pos;
+	long ret;
+
+	f = fdget_pos(fd);
+	if (!f.file)
+		return -EBADF;
+	ret = -EBADF;
+	if (!(f.file->f_mode & (load ? FMODE_READ : FMODE_WRITE)))
+		goto out;
+	/* fd 可用了才建表，传错 fd 不会留下一张空表 */
+	ret = -ENOMEM;
+	kv = load ? kv_store_get_or_create() : kv_store_current();
+	if (load && !kv)
+		goto out;
+	kv_write_barrier(kv);
+
+	io.buf = kvmalloc(KV_DUMP_CHUNK, GFP_KERNEL);
+	if (!io.buf)
+		goto out;
+	io.file = f.file;
+	pos = f.file->f_pos;
+	io.ppos = (f.file->f_mode & FMODE_STREAM) ? NULL : &pos;
+
+	ret = load ? kv_load(kv, &io) : kv_dump(kv, &io);
+	if (io.ppos) {
+		/* 读多了的退回去，文件位置停在转储末尾 */
+		if (load)
+			pos -= io.len - io.off;
+		f.file->f_pos = pos;
+	}
+	kvfree(io.buf);
+out:
+	fdput_pos(f);
+	return ret;
+}
+
+/*
+ * 把整张表写到 @fd 的当前位置，返回写出的条数。表不存在时写出一个
+ * 空的转储。
+ */
+SYSCALL_DEFINE1(kv_dump, unsigned int, fd)
+{
+	return kv_dump_fd(fd, false);
+}
+
+/*
+ * 从 @fd 的当前位置读入 kv_dump 写出的内容并放进表里，返回条数。
+ * 格式不对返回 -EINVAL，截断或校验失败返回 -EBADMSG，这两种情况下
+ * 表不变。成功时 @fd 的位置停在转储末尾，后面的数据不会被读走。
+ */
+SYSCALL_DEFINE1(kv_load, unsigned int, fd)
+{
+	return kv_dump_fd(fd, true);
+}
+
+/*
+ * 模式只能在表创建时决定：表还不存在就按 @mode 创建，已经存在时
+ * 模式相同返回 0，不同返回 -EBUSY。
+ */
+static int kv_ctl_set_mode(unsigned int mode)
+{
+	struct kv_store *kv = kv_store_current(), *old;
+
+	if (mode & ~KV_MODE_MASK)
+		return -EINVAL;
+	/* 有序索引跨段共享不了 */
+	if ((mode & KV_MODE_ORDERED) && (mode & KV_MODE_INHERIT))
+		return -EINVAL;
+	if ((mode & KV_MODE_EVENTUAL) && !(mode & KV_MODE_BUFFERED))
+		return -EINVAL;
+	if (!kv) {
+		kv = kv_store_alloc(mode);
+		if (!kv)
+			return -ENOMEM;
+		old = kv_store_install(kv);
+		if (!old)
+			return 0;
+		kv_store_put(kv);
+		kv = old;
+	}
+	return kv->mode == mode ? 0 : -EBUSY;
+}
+
+/*
+ * 把 kv_ns_open() 得到的命名表设成本线程组的表。线程组已经有表时
+ * 返回 -EBUSY（已经挂的就是它时返回 0）：表在线程组的生命周期内
+ * 不会更换，别的线程手里的指针才一直有效。
+ */
+static int kv_ctl_attach(int fd)
+{
+	struct kv_store *kv, *old;
+
+	kv = kv_ns_get_fd(fd);
+	if (IS_ERR(kv))
+		return PTR_ERR(kv);
+	old = kv_store_install(kv);
+	if (!old)
+		return 0;	/* 引用归线程组 */
+	kv_store_put(kv);
+	return old == kv ? 0 : -EBUSY;
+}
+
+SYSCALL_DEFINE2(kv_ctl, unsigned int, cmd, unsigned long, arg)
+{
+	struct kv_store *kv;
+
+	switch (cmd) {
+	case KV_CTL_SET_MODE:
+		return kv_ctl_set_mode(arg);
+	case KV_CTL_GET_MODE:
+		kv = kv_store_current();
+		return kv ? kv->mode : 0;
+	case KV_CTL_FLUSH:
+		return kv_wbuf_flush_current(true);
+	case KV_CTL_ATTACH:
+		return kv_ctl_attach(arg);
+	case KV_CTL_SET_TTL:
+	case KV_CTL_SET_CAPACITY:
+		if (arg > INT_MAX)
+			return -EINVAL;
+		kv = kv_store_get_or_create();
+		if (!kv)
+			return -ENOMEM;
+		if (cmd == KV_CTL_SET_TTL)
+			WRITE_ONCE(kv->default_ttl, arg);
+		else
+			WRITE_ONCE(kv->capacity, arg);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* 统计链长时每数这么多个桶退出一次 RCU，让出 CPU */
+#define KV_STATS_BATCH		1024
+
+/*
+ * /proc/<pid>/kv_stats。链长按各段当前的桶数组统计（扩缩容中的新表
+ * 不算），遍历在 RCU 下进行，不影响读写。大表分批数，批与批之间如果
+ * 正好扩缩容了，就在新的桶数组上接着数，结果只是近似值。
+ */
+static void kv_seg_chain_stats(struct kv_seg *seg, unsigned long *buckets,
+			       unsigned long *used, unsigned long *max_chain)
+{
+	struct bucket_table *tbl;
+	struct rhash_head *pos;
+	unsigned int i = 0, end, size;
+
+	do {
+		rcu_read_lock();
+		tbl = rht_dereference_rcu(seg->ht.tbl, &seg->ht);
+		size = tbl->size;
+		if (!i)
+			*buckets += size;
+		end = min(i + KV_STATS_BATCH, size);
+		for (; i < end; i++) {
+			unsigned long len = 0;
+
+			rht_for_each_rcu(pos, tbl, i)
+				len++;
+			if (len)
+				(*used)++;
+			if (len > *max_chain)
+				*max_chain = len;
+		}
+		rcu_read_unlock();
+		cond_resched();
+	} while (i < size);
+}
+
+void kv_store_show_stats(struct seq_file *m, struct task_struct *task)
+{
+	struct kv_store *kv = kv_store_get_task(task);
+	struct kv_pcpu_stats sum = {};
+	unsigned long buckets = 0, used = 0, max_chain = 0, entries;
+	unsigned int i;
+	int cpu;
+
+	if (!kv) {
+		seq_puts(m, "entries:\t0\n");
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct kv_pcpu_stats *st = per_cpu_ptr(kv->stats, cpu);
+
+		sum.hits += READ_ONCE(st->hits);
+		sum.misses += READ_ONCE(st->misses);
+		sum.inserts += READ_ONCE(st->inserts);
+		sum.updates += READ_ONCE(st->updates);
+		sum.deletes += READ_ONCE(st->deletes);
+		sum.contended += READ_ONCE(st->contended);
+		sum.cow_copies += READ_ONCE(st->cow_copies);
+		sum.expired += READ_ONCE(st->expired);
+		sum.evictions += READ_ONCE(st->evictions);
+	}
+	for (i = 0; i < kv_nr_segs(kv); i++) {
+		struct kv_seg *seg = kv_seg_pin(kv, i);
+
+		kv_seg_chain_stats(seg, &buckets, &used, &max_chain);
+		kv_seg_put(seg);
+		cond_resched();
+	}
+	entries = kv_nelems(kv);
+
+	seq_printf(m, "entries:\t%lu\n", entries);
+	seq_printf(m, "max_entries:\t%d\n", kv->max_entries);
+	seq_printf(m, "capacity:\t%u\n", READ_ONCE(kv->capacity));
+	seq_printf(m, "default_ttl_ms:\t%u\n", READ_ONCE(kv->default_ttl));
+	seq_printf(m, "mode:\t%#x\n", kv->mode);
+	seq_printf(m, "segments:\t%u\n", kv_nr_segs(kv));
+	seq_printf(m, "buckets:\t%lu\n", buckets);
+	seq_printf(m, "buckets_used:\t%lu\n", used);
+	seq_printf(m, "max_chain:\t%lu\n", max_chain);
+	/* 平均链长只算非空桶，保留两位小数 */
+	seq_printf(m, "mean_chain:\t%lu.%02lu\n",
+		   used ? entries / used : 0,
+		   used ? entries * 100 / used % 100 : 0);
+	seq_printf(m, "hits:\t%llu\n", sum.hits);
+	seq_printf(m, "misses:\t%llu\n", sum.misses);
+	seq_printf(m, "inserts:\t%llu\n", sum.inserts);
+	seq_printf(m, "updates:\t%llu\n", sum.updates);
+	seq_printf(m, "deletes:\t%llu\n", sum.deletes);
+	seq_printf(m, "contended:\t%llu\n", sum.contended);
+	seq_printf(m, "cow_copies:\t%llu\n", sum.cow_copies);
+	seq_printf(m, "expired:\t%llu\n", sum.expired);
+	seq_printf(m, "evictions:\t%llu\n", sum.evictions);
+	kv_store_put(kv);
+}
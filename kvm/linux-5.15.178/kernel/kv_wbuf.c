@@ -0,0 +1,226 @@
+#include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/hash.h>
+#include <linux/memcontrol.h>
+#include <linux/kv_store.h>
+
+/*
+ * KV_MODE_BUFFERED：每个线程一个私有的写缓冲区，不超过 8 字节的写入
+ * 先合并在这里，同一个键反复写只留最后一次。以下时机刷进共享的表：
+ *   - 缓冲区满；
+ *   - 第一条写入后过了 KV_WBUF_MAX_AGE（后台 delayed_work）；
+ *   - 本线程做其它会看到表的操作之前（批量、删除、扫描、大值写入、环）；
+ *   - kv_ctl(KV_CTL_FLUSH)；
+ *   - 线程退出。
+ * 本线程读的时候先查自己的缓冲区（除非 KV_MODE_EVENTUAL），其它线程
+ * 最迟在 KV_WBUF_MAX_AGE 之后看到。
+ *
+ * 缓冲区的锁只有本线程和自己的刷写 work 会拿，平时没有争用。
+ */
+
+#define KV_WBUF_BITS		6
+#define KV_WBUF_SLOTS		(1U << KV_WBUF_BITS)
+#define KV_WBUF_MAX_USED	(KV_WBUF_SLOTS / 4 * 3)
+#define KV_WBUF_MAX_AGE		msecs_to_jiffies(10)
+
+struct kv_wbuf_ent {
+	u64 key;
+	u64 word;
+	u32 len;
+	u32 used;
+};
+
+struct kv_wbuf {
+	struct mutex lock;
+	struct kv_store *kv;		/* 持有引用 */
+	struct mem_cgroup *memcg;	/* 后台刷写时分配的条目记到这里 */
+	struct delayed_work flush_work;
+	unsigned int nr;
+	int err;			/* 后台刷写遇到的第一个错误 */
+	struct kv_wbuf_ent ents[KV_WBUF_SLOTS];
+};
+
+/* 调用者持有 wb->lock */
+static int __kv_wbuf_flush(struct kv_wbuf *wb)
+{
+	unsigned int i;
+	int ret, err = 0;
+
+	if (!wb->nr)
+		return 0;
+	for (i = 0; i < KV_WBUF_SLOTS; i++) {
+		struct kv_wbuf_ent *e = &wb->ents[i];
+
+		if (!e->used)
+			continue;
+		ret = kv_set(wb->kv, e->key, &e->word, e->len);
+		if (ret && !err)
+			err = ret;
+		e->used = 0;
+	}
+	wb->nr = 0;
+	return err;
+}
+
+static void kv_wbuf_flush_work(struct work_struct *work)
+{
+	struct kv_wbuf *wb = container_of(to_delayed_work(work),
+					  struct kv_wbuf, flush_work);
+	struct mem_cgroup *old_memcg;
+	int ret;
+
+	old_memcg = set_active_memcg(wb->memcg);
+	mutex_lock(&wb->lock);
+	ret = __kv_wbuf_flush(wb);
+	if (ret && !wb->err)
+		wb->err = ret;
+	mutex_unlock(&wb->lock);
+	set_active_memcg(old_memcg);
+}
+
+static void kv_wbuf_free(struct kv_wbuf *wb)
+{
+	cancel_delayed_work_sync(&wb->flush_work);
+	mutex_lock(&wb->lock);
+	__kv_wbuf_flush(wb);
+	mutex_unlock(&wb->lock);
+	kv_store_put(wb->kv);
+	mem_cgroup_put(wb->memcg);
+	kfree(wb);
+}
+
+static struct kv_wbuf *kv_wbuf_alloc(struct kv_store *kv)
+{
+	struct kv_wbuf *wb;
+
+	wb = kzalloc(sizeof(*wb), GFP_KERNEL_ACCOUNT);
+	if (!wb)
+		return NULL;
+	mutex_init(&wb->lock);
+	INIT_DELAYED_WORK(&wb->flush_work, kv_wbuf_flush_work);
+	kv_store_get(kv);
+	wb->kv = kv;
+	wb->memcg = get_mem_cgroup_from_mm(current->mm);
+	return wb;
+}
+
+/* 返回 @key 所在的槽或应该放进去的空槽 */
+static struct kv_wbuf_ent *kv_wbuf_slot(struct kv_wbuf *wb, u64 key)
+{
+	u32 i = hash_64(key, KV_WBUF_BITS);
+
+	while (wb->ents[i].used && wb->ents[i].key != key)
+		i = (i + 1) & (KV_WBUF_SLOTS - 1);
+	return &wb->ents[i];
+}
+
+/*
+ * 把一次写入放进当前线程的缓冲区。返回 false 表示没有缓冲（值太长
+ * 或分配失败），调用者应直接写表。
+ */
+bool kv_wbuf_put(struct kv_store *kv, u64 key, const void *val, u32 len)
+{
+	struct kv_wbuf *wb = current->kv_wbuf;
+	struct kv_wbuf_ent *e;
+	u64 word = 0;
+	int ret;
+
+	if (len > sizeof(word))
+		return false;
+	if (!wb || wb->kv != kv) {
+		/* exec 等原因换了表，旧缓冲区先刷掉 */
+		if (wb)
+			kv_wbuf_free(wb);
+		wb = kv_wbuf_alloc(kv);
+		current->kv_wbuf = wb;
+		if (!wb)
+			return false;
+	}
+	memcpy(&word, val, len);
+
+	mutex_lock(&wb->lock);
+	e = kv_wbuf_slot(wb, key);
+	if (!e->used) {
+		if (wb->nr >= KV_WBUF_MAX_USED) {
+			ret = __kv_wbuf_flush(wb);
+			if (ret && !wb->err)
+				wb->err = ret;
+			e = kv_wbuf_slot(wb, key);
+		}
+		e->key = key;
+		e->used = 1;
+		if (!wb->nr++)
+			schedule_delayed_work(&wb->flush_work, KV_WBUF_MAX_AGE);
+	}
+	e->word = word;
+	e->len = len;
+	mutex_unlock(&wb->lock);
+	return true;
+}
+
+/*
+ * 在当前线程的缓冲区里找 @key，语义同 kv_get()；没有缓冲这个键时
+ * 返回 -ENOENT，调用者再去查表。
+ */
+int kv_wbuf_get(struct kv_store *kv, u64 key, void *buf, u32 size, u32 *vlen)
+{
+	struct kv_wbuf *wb = current->kv_wbuf;
+	struct kv_wbuf_ent *e;
+	int ret = -ENOENT;
+
+	if (!wb || wb->kv != kv || !READ_ONCE(wb->nr))
+		return ret;
+	mutex_lock(&wb->lock);
+	e = kv_wbuf_slot(wb, key);
+	if (e->used) {
+		*vlen = e->len;
+		ret = -EMSGSIZE;
+		if (e->len <= size) {
+			memcpy(buf, &e->word, e->len);
+			ret = 0;
+		}
+	}
+	mutex_unlock(&wb->lock);
+	return ret;
+}
+
+/*
+ * 把当前线程缓冲的写入刷进表。@take_err 时返回并清掉上次取走之后的
+ * 第一个错误（KV_CTL_FLUSH），否则错误留给下一次 KV_CTL_FLUSH。
+ */
+int kv_wbuf_flush_current(bool take_err)
+{
+	struct kv_wbuf *wb = current->kv_wbuf;
+	int ret;
+
+	if (!wb)
+		return 0;
+	mutex_lock(&wb->lock);
+	ret = __kv_wbuf_flush(wb);
+	if (ret && !wb->err)
+		wb->err = ret;
+	ret = 0;
+	if (take_err) {
+		ret = wb->err;
+		wb->err = 0;
+	}
+	mutex_unlock(&wb->lock);
+	return ret;
+}
+
+/* 线程退出时调用，缓冲的写入在表被释放之前刷进去 */
+void exit_kv_wbuf(struct task_struct *tsk)
+{
+	struct kv_wbuf *wb = tsk->kv_wbuf;
+
+	if (!wb)
+		return;
+	tsk->kv_wbuf = NULL;
+	kv_wbuf_free(wb);
+}
@@ -1,21 +1,86 @@
 #include <linux/spinlock.h>
 #include <linux/syscalls.h>
 #include <linux/sched.h>
+#include <linux/sched/signal.h>
 #include <linux/uaccess.h>
 #include <linux/printk.h>
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/list.h>
+#include <linux/socket_attrs.h>
 
-SYSCALL_DEFINE4(set_thread_socket_attrs, pid_t, pid, int, max_sockets, 
-               int, priority_level, unsigned int, flags)
+/* 只允许同一个用户或root用户设置，@cap 是调用者有没有 CAP_SYS_RESOURCE */
+static bool socket_attrs_permitted(struct task_struct *task, bool cap)
+{
+    return cap ||
+           uid_eq(current_euid(), task_euid(task)) ||
+           uid_eq(current_euid(), task_uid(task));
+}
+
+/* 只给了限速没给突发量时允许的突发字节数 */
+#define SOCKET_ATTR_DEFAULT_BURST (64 * 1024)
+
+static void socket_attrs_apply(struct task_struct *task,
+                               const struct socket_attrs *attrs,
+                               unsigned int flags)
+{
+    /* 设置最大socket数 */
+    if (attrs->max_sockets >= -1) /* -1表示不限制 */
+        WRITE_ONCE(task->max_socket_allowed, attrs->max_sockets);
+
+    /* 设置优先级级别 */
+    if (attrs->priority_level >= 0 && attrs->priority_level <= 100)
+        WRITE_ONCE(task->priority_level, attrs->priority_level);
+
+    /* 设置发送限速，之前欠下的额度一笔勾销 */
+    if (attrs->rate != SOCKET_ATTR_RATE_KEEP) {
+        WRITE_ONCE(task->sock_burst, attrs->burst ?: SOCKET_ATTR_DEFAULT_BURST);
+        WRITE_ONCE(task->sock_rate, attrs->rate);
+        atomic64_set(&task->sock_tat, 0);
+    }
+
+    WRITE_ONCE(task->socket_attr_flags, flags & SOCKET_ATTR_INHERIT);
+}
+
+/*
+ * SOCKET_ATTR_RECURSIVE：一次设置 @task 所在线程组的所有线程，有一个
+ * 线程没有权限就都不设置。遍历时拿着 siglock：copy_process() 在同一把
+ * 锁下把新线程挂上链表，并从创建者重新复制属性（copy_socket_attrs()），
+ * 新线程要么被遍历到，要么拿到的已经是新值。
+ */
+static int socket_attrs_apply_group(struct task_struct *task,
+                                    const struct socket_attrs *attrs,
+                                    unsigned int flags)
+{
+    bool cap = capable(CAP_SYS_RESOURCE);
+    struct task_struct *t;
+    unsigned long irqflags;
+    int ret = 0;
+
+    if (!lock_task_sighand(task, &irqflags))
+        return -ESRCH;
+    for_each_thread(task, t) {
+        if (!socket_attrs_permitted(t, cap)) {
+            ret = -EPERM;
+            goto out;
+        }
+    }
+    for_each_thread(task, t)
+        socket_attrs_apply(t, attrs, flags);
+out:
+    unlock_task_sighand(task, &irqflags);
+    return ret;
+}
+
+static int do_set_thread_socket_attrs(pid_t pid,
+                                      const struct socket_attrs *attrs,
+                                      unsigned int flags)
 {
     struct task_struct *task;
     int ret = 0;
     
-    /* flags目前未使用，预留扩展 */
-    if (flags != 0)
+    if (flags & ~SOCKET_ATTR_ALL)
         return -EINVAL;
         
     /* pid为0表示当前线程 */
@@ -32,24 +97,60 @@ SYSCALL_DEFINE4(set_thread_socket_attrs, pid_t, pid, int, max_sockets,
         rcu_read_unlock();
     }
     
-    /* 检查权限 - 只允许同一个用户或root用户设置 */
-    if (!capable(CAP_SYS_RESOURCE) && 
-        !uid_eq(current_euid(), task_euid(task)) &&
-        !uid_eq(current_euid(), task_uid(task))) {
+    if (flags & SOCKET_ATTR_RECURSIVE) {
+        ret = socket_attrs_apply_group(task, attrs, flags);
+    } else if (socket_attrs_permitted(task, capable(CAP_SYS_RESOURCE))) {
+        socket_attrs_apply(task, attrs, flags);
+    } else {
         ret = -EPERM;
-        goto out;
+    }
+
+    /* 已经打开的socket也按新的优先级和限速重新设置 */
+    if (!ret) {
+        unsigned int what = 0;
+
+        if (attrs->priority_level >= 0 && attrs->priority_level <= 100)
+            what |= SOCK_PRIO_UPDATE_LEVEL;
+        if (attrs->rate != SOCKET_ATTR_RATE_KEEP)
+            what |= SOCK_PRIO_UPDATE_RATE;
+        if (what)
+            sock_prio_map_update_task(task, flags & SOCKET_ATTR_RECURSIVE,
+                                      what);
     }
     
-    /* 设置最大socket数 */
-    if (max_sockets >= -1) /* -1表示不限制 */
-        task->max_socket_allowed = max_sockets;
-        
-    /* 设置优先级级别 */
-    if (priority_level >= 0 && priority_level <= 100)
-        task->priority_level = priority_level;
-    
-out:
     if (pid != 0)
         put_task_struct(task);
     return ret;
-}
\ No newline at end of file
+}
+
+SYSCALL_DEFINE4(set_thread_socket_attrs, pid_t, pid, int, max_sockets, 
+               int, priority_level, unsigned int, flags)
+{
+    struct socket_attrs attrs = {
+        .max_sockets = max_sockets,
+        .priority_level = priority_level,
+        .rate = SOCKET_ATTR_RATE_KEEP,
+    };
+
+    return do_set_thread_socket_attrs(pid, &attrs, flags);
+}
+
+/*
+ * 结构体版本，多了发送限速。@usize 是调用者的 struct socket_attrs
+ * 大小，新旧版本之间按 copy_struct_from_user() 的规则兼容。
+ */
+SYSCALL_DEFINE4(set_thread_socket_attrs2, pid_t, pid,
+                const struct socket_attrs __user *, uattrs, size_t, usize,
+                unsigned int, flags)
+{
+    struct socket_attrs attrs;
+    int ret;
+
+    BUILD_BUG_ON(sizeof(attrs) != SOCKET_ATTRS_SIZE_VER0);
+    if (usize < SOCKET_ATTRS_SIZE_VER0)
+        return -EINVAL;
+    ret = copy_struct_from_user(&attrs, sizeof(attrs), uattrs, usize);
+    if (ret)
+        return ret;
+    return do_set_thread_socket_attrs(pid, &attrs, flags);
+}
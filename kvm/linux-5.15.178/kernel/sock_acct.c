@@ -0,0 +1,197 @@
+#include <linux/sched.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/atomic.h>
+#include <linux/refcount.h>
+#include <linux/fs.h>
+#include <linux/net.h>
+#include <linux/socket_attrs.h>
+
+/*
+ * 线程打开的 socket 计数。每个线程第一次创建 socket 时分配一个
+ * sock_acct，挂在 task->sock_acct 上，到 task_struct 释放为止不再换；
+ * 同一线程组共享组长的 group 汇总。
+ *
+ * socket 记在谁名下存在 sockfs inode 的 i_private 里（sockfs 自己不用
+ * 这个字段），这样谁关闭都能减到原来的线程头上，线程退出后关闭的
+ * socket 也不会减错人。记的是一个 sock_charge，同时记着 socket 计在
+ * 哪个 cgroup 的限制里（见 sock_cgroup.c）。
+ */
+
+struct sock_charge {
+	struct sock_acct *acct;
+	struct sock_cg *cg;		/* 没有配置 cgroup 限制时为 NULL */
+	struct sock_prio_applied prio;	/* 由 sock_prio_map.c 维护 */
+};
+
+static struct kmem_cache *sock_charge_cachep __ro_after_init;
+
+static int __init sock_acct_init(void)
+{
+	sock_charge_cachep = KMEM_CACHE(sock_charge, SLAB_PANIC | SLAB_ACCOUNT);
+	return 0;
+}
+core_initcall(sock_acct_init);
+
+static struct sock_acct *sock_acct_alloc(struct sock_acct *group)
+{
+	struct sock_acct *acct;
+
+	acct = kzalloc(sizeof(*acct), GFP_KERNEL_ACCOUNT);
+	if (!acct)
+		return NULL;
+	refcount_set(&acct->ref, 1);
+	atomic_set(&acct->count, 0);
+	if (group)
+		refcount_inc(&group->ref);
+	acct->group = group;
+	return acct;
+}
+
+void sock_acct_put(struct sock_acct *acct)
+{
+	if (acct && refcount_dec_and_test(&acct->ref)) {
+		sock_acct_put(acct->group);
+		kfree(acct);
+	}
+}
+
+/*
+ * 给 @tsk 装上一个挂在 @group 下的计数。和别人并发装时以先装上的为准，
+ * task->sock_acct 只会从 NULL 变成非 NULL。
+ */
+static struct sock_acct *sock_acct_install(struct task_struct *tsk,
+					   struct sock_acct *group)
+{
+	struct sock_acct *acct, *old;
+
+	acct = sock_acct_alloc(group);
+	if (!acct)
+		return NULL;
+	old = cmpxchg(&tsk->sock_acct, NULL, acct);
+	if (old) {
+		sock_acct_put(acct);
+		return old;
+	}
+	return acct;
+}
+
+static struct sock_acct *sock_acct_current(void)
+{
+	struct task_struct *leader = current->group_leader;
+	struct sock_acct *acct, *lacct, *group;
+
+	acct = READ_ONCE(current->sock_acct);
+	if (acct)
+		return acct;
+
+	/* 组长的计数持有组的汇总，先保证它在 */
+	lacct = READ_ONCE(leader->sock_acct);
+	if (!lacct) {
+		group = sock_acct_alloc(NULL);
+		if (!group)
+			return NULL;
+		lacct = sock_acct_install(leader, group);
+		sock_acct_put(group);
+		if (!lacct)
+			return NULL;
+	}
+	if (leader == current)
+		return lacct;
+	return sock_acct_install(current, lacct->group);
+}
+
+/*
+ * 把 @sock 记到当前线程名下，同时计入当前 cgroup 的限制。超过 cgroup
+ * 的限制返回 -EMFILE。
+ */
+int sock_acct_charge(struct socket *sock)
+{
+	struct sock_acct *acct = sock_acct_current();
+	struct sock_charge *charge;
+	struct sock_cg *cg;
+
+	if (!acct)
+		return -ENOMEM;
+	charge = kmem_cache_zalloc(sock_charge_cachep, GFP_KERNEL);
+	if (!charge)
+		return -ENOMEM;
+	cg = sock_cg_charge();
+	if (IS_ERR(cg)) {
+		kmem_cache_free(sock_charge_cachep, charge);
+		return PTR_ERR(cg);
+	}
+	refcount_inc(&acct->ref);
+	atomic_inc(&acct->count);
+	atomic_inc(&acct->group->count);
+	charge->acct = acct;
+	charge->cg = cg;
+	SOCK_INODE(sock)->i_private = charge;
+	return 0;
+}
+
+/* sock_release() 调用，可以在任何线程里 */
+void sock_acct_uncharge(struct socket *sock)
+{
+	struct inode *inode = SOCK_INODE(sock);
+	struct sock_charge *charge = inode->i_private;
+	struct sock_acct *acct;
+
+	if (!charge)
+		return;
+	inode->i_private = NULL;
+	acct = charge->acct;
+	atomic_dec(&acct->group->count);
+	atomic_dec(&acct->count);
+	sock_acct_put(acct);
+	sock_cg_uncharge(charge->cg);
+	kmem_cache_free(sock_charge_cachep, charge);
+}
+
+/* @sock 记在哪个线程名下，内核自己建的 socket 返回 NULL */
+struct sock_acct *sock_acct_owner(struct socket *sock)
+{
+	struct sock_charge *charge = SOCK_INODE(sock)->i_private;
+
+	return charge ? charge->acct : NULL;
+}
+
+/* @sock 上 sock_prio_map 设过的值，内核自己建的 socket 返回 NULL */
+struct sock_prio_applied *sock_acct_prio(struct socket *sock)
+{
+	struct sock_charge *charge = SOCK_INODE(sock)->i_private;
+
+	return charge ? &charge->prio : NULL;
+}
+
+/*
+ * 新 socket 该用的 priority_level：线程自己设置过就用线程的，否则用
+ * 所在 cgroup 配置的默认值。
+ */
+int sock_acct_priority_level(struct socket *sock)
+{
+	struct sock_charge *charge = SOCK_INODE(sock)->i_private;
+	int level = current->priority_level;
+
+	if (level <= 0 && charge)
+		level = sock_cg_priority_level(charge->cg);
+	return level;
+}
+
+/* 调用者持有 @task 的引用，计数对象在 task_struct 释放前不会消失 */
+int sock_acct_count(struct task_struct *task)
+{
+	struct sock_acct *acct = READ_ONCE(task->sock_acct);
+
+	return acct ? atomic_read(&acct->count) : 0;
+}
+
+int sock_acct_group_count(struct task_struct *task)
+{
+	struct sock_acct *acct = READ_ONCE(task->sock_acct);
+
+	if (!acct)
+		acct = READ_ONCE(task->group_leader->sock_acct);
+	return acct ? atomic_read(&acct->group->count) : 0;
+}
@@ -0,0 +1,316 @@
+#include <linux/syscalls.h>
+#include <linux/sched.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/xarray.h>
+#include <linux/cgroup.h>
+#include <linux/capability.h>
+#include <linux/cred.h>
+#include <linux/fs.h>
+#include <linux/dcache.h>
+#include <linux/file.h>
+#include <linux/init.h>
+#include <linux/nsproxy.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/socket_attrs.h>
+
+/*
+ * 按 cgroup（v2 层级）限制 socket 个数并给默认的 priority_level。
+ * set_cgroup_socket_attrs() 对一个 cgroup 目录配置一次，整个服务里的
+ * 所有进程和线程都受约束。
+ *
+ * 配置过的 cgroup 各有一个 sock_cg，放在以 cgroup id 为下标的 xarray
+ * 里；配置某个 cgroup 时把它到根之下的祖先也都补上（不限制），所以
+ * sock_cg->parent 就是父 cgroup 的那个，建好就不变。新 socket 找到
+ * 所在 cgroup 最近的 sock_cg，沿 parent 一路 atomic_inc_return() 检查
+ * 上限，不拿锁；socket 记着当时的 sock_cg，关闭时沿同一条链减回去。
+ * 根 cgroup 不能配置，省得每个 socket 都去碰同一个全局计数。
+ *
+ * 配置之前就已经打开的 socket 不计入新配置的 cgroup。cgroup 删掉以后
+ * 它的 sock_cg 在下一次配置时从 xarray 里清掉，由最后一个 socket 释放。
+ *
+ * 配置和当前的 socket 数从 /proc/socket_cgroups 读。
+ */
+
+struct sock_cg {
+	refcount_t ref;			/* xarray 一个，子节点、名下的 socket 各一个 */
+	atomic_t count;
+	int max;			/* -1 表示不限制 */
+	int priority_level;		/* 没有配置时为 -1 */
+	struct sock_cg *parent;
+	struct rcu_head rcu;
+};
+
+static DEFINE_XARRAY(sock_cg_xa);
+static DEFINE_MUTEX(sock_cg_lock);	/* 串行化配置 */
+
+static void sock_cg_put(struct sock_cg *cg)
+{
+	while (cg && refcount_dec_and_test(&cg->ref)) {
+		struct sock_cg *parent = cg->parent;
+
+		kfree_rcu(cg, rcu);
+		cg = parent;
+	}
+}
+
+/* 调用者在 RCU 读临界区里 */
+static struct sock_cg *sock_cg_find(struct cgroup *cgrp)
+{
+	struct sock_cg *cg;
+
+	for (; cgroup_parent(cgrp); cgrp = cgroup_parent(cgrp)) {
+		cg = xa_load(&sock_cg_xa, cgroup_id(cgrp));
+		if (cg)
+			return cg;
+	}
+	return NULL;
+}
+
+static void sock_cg_undo(struct sock_cg *cg, struct sock_cg *stop)
+{
+	for (; cg != stop; cg = cg->parent)
+		atomic_dec(&cg->count);
+}
+
+/*
+ * 把一个新 socket 计入当前 cgroup，返回要记在 socket 上的 sock_cg（持有
+ * 引用），没有配置时返回 NULL，超过任何一层的上限返回 ERR_PTR(-EMFILE)。
+ */
+struct sock_cg *sock_cg_charge(void)
+{
+	struct sock_cg *cg, *c;
+
+	if (xa_empty(&sock_cg_xa))
+		return NULL;
+
+	rcu_read_lock();
+	cg = sock_cg_find(task_dfl_cgroup(current));
+	if (cg && !refcount_inc_not_zero(&cg->ref))
+		cg = NULL;
+	rcu_read_unlock();
+	if (!cg)
+		return NULL;
+
+	for (c = cg; c; c = c->parent) {
+		int max = READ_ONCE(c->max);
+
+		if (atomic_inc_return(&c->count) > max && max >= 0) {
+			sock_cg_undo(cg, c->parent);
+			sock_cg_put(cg);
+			return ERR_PTR(-EMFILE);
+		}
+	}
+	return cg;
+}
+
+void sock_cg_uncharge(struct sock_cg *cg)
+{
+	if (!cg)
+		return;
+	sock_cg_undo(cg, NULL);
+	sock_cg_put(cg);
+}
+
+/* 离 @cg 最近的配置过的默认 priority_level，没有返回 0 */
+int sock_cg_priority_level(struct sock_cg *cg)
+{
+	for (; cg; cg = cg->parent) {
+		int level = READ_ONCE(cg->priority_level);
+
+		if (level >= 0)
+			return level;
+	}
+	return 0;
+}
+
+/* 调用者持有 sock_cg_lock。清掉已经删除的 cgroup 的配置 */
+static void sock_cg_prune(void)
+{
+	struct sock_cg *cg;
+	unsigned long id;
+
+	xa_for_each(&sock_cg_xa, id, cg) {
+		struct cgroup *cgrp = cgroup_get_from_id(id);
+
+		if (cgrp) {
+			cgroup_put(cgrp);
+			continue;
+		}
+		xa_erase(&sock_cg_xa, id);
+		sock_cg_put(cg);
+	}
+}
+
+/*
+ * 调用者持有 sock_cg_lock。取 @cgrp 的 sock_cg，没有就连同祖先一起建。
+ * 按 ancestor_ids 从根下第一层往下走，不递归，层级再深也不会爆栈。
+ */
+static struct sock_cg *sock_cg_get_or_create(struct cgroup *cgrp)
+{
+	struct sock_cg *cg, *parent = NULL;
+	int level, ret;
+
+	for (level = 1; level <= cgrp->level; level++) {
+		u64 id = cgrp->ancestor_ids[level];
+
+		cg = xa_load(&sock_cg_xa, id);
+		if (!cg) {
+			cg = kzalloc(sizeof(*cg), GFP_KERNEL_ACCOUNT);
+			if (!cg)
+				return ERR_PTR(-ENOMEM);
+			refcount_set(&cg->ref, 1);
+			atomic_set(&cg->count, 0);
+			cg->max = -1;
+			cg->priority_level = -1;
+			if (parent)
+				refcount_inc(&parent->ref);
+			cg->parent = parent;
+			ret = xa_err(xa_store(&sock_cg_xa, id, cg, GFP_KERNEL));
+			if (ret) {
+				sock_cg_put(cg);
+				return ERR_PTR(ret);
+			}
+		}
+		parent = cg;
+	}
+	return parent;
+}
+
+/*
+ * 调用者能不能配置 @f 这个 cgroup 目录：要么有 CAP_SYS_RESOURCE，要么
+ * 父目录是自己的。只看目录本身的属主的话，被委派了一棵子树的用户能把
+ * 管理员给子树根配的限制改掉；按父目录算，委派出去的人只能配置子孙。
+ */
+static bool sock_cg_permitted(struct file *file)
+{
+	struct dentry *dentry = file->f_path.dentry, *parent;
+	bool ret;
+
+	if (capable(CAP_SYS_RESOURCE))
+		return true;
+	/* 挂载点的根（比如 cgroup 命名空间的根）看不到父目录 */
+	if (IS_ROOT(dentry))
+		return false;
+	parent = dget_parent(dentry);
+	ret = uid_eq(current_euid(), d_inode(parent)->i_uid);
+	dput(parent);
+	return ret;
+}
+
+/*
+ * 同 cgroup_get_from_fd()，但直接用已经检查过权限的 @file，不再按 fd
+ * 查一次：两次查找之间 fd 可能被 dup2() 换成别的 cgroup 目录。
+ */
+static struct cgroup *sock_cg_from_file(struct file *file)
+{
+	struct cgroup_subsys_state *css;
+	struct cgroup *cgrp;
+
+	css = css_tryget_online_from_dir(file->f_path.dentry, NULL);
+	if (IS_ERR(css))
+		return ERR_CAST(css);
+	cgrp = css->cgroup;
+	if (cgrp->root != &cgrp_dfl_root) {
+		cgroup_put(cgrp);
+		return ERR_PTR(-EBADF);
+	}
+	return cgrp;
+}
+
+/*
+ * 配置 @cgroup_fd（cgroup v2 目录）下所有任务的 socket 上限和默认优先级。
+ * @max_sockets 为 -1 表示不限制、小于 -1 表示不改；@priority_level 在
+ * 0~100 之外表示不改。需要 CAP_SYS_RESOURCE，或者父 cgroup 目录委派给了
+ * 调用者。
+ */
+SYSCALL_DEFINE4(set_cgroup_socket_attrs, int, cgroup_fd, int, max_sockets,
+		int, priority_level, unsigned int, flags)
+{
+	struct cgroup *cgrp;
+	struct sock_cg *cg;
+	struct fd f;
+	int ret;
+
+	if (flags)
+		return -EINVAL;
+
+	f = fdget(cgroup_fd);
+	if (!f.file)
+		return -EBADF;
+	ret = -EPERM;
+	if (!sock_cg_permitted(f.file))
+		goto out_fdput;
+
+	cgrp = sock_cg_from_file(f.file);
+	ret = PTR_ERR(cgrp);
+	if (IS_ERR(cgrp))
+		goto out_fdput;
+	ret = -EINVAL;
+	if (!cgroup_parent(cgrp))
+		goto out_put;
+
+	mutex_lock(&sock_cg_lock);
+	sock_cg_prune();
+	cg = sock_cg_get_or_create(cgrp);
+	ret = PTR_ERR_OR_ZERO(cg);
+	if (!ret) {
+		if (max_sockets >= -1)
+			WRITE_ONCE(cg->max, max_sockets);
+		if (priority_level >= 0 && priority_level <= 100)
+			WRITE_ONCE(cg->priority_level, priority_level);
+	}
+	mutex_unlock(&sock_cg_lock);
+out_put:
+	cgroup_put(cgrp);
+out_fdput:
+	fdput(f);
+	return ret;
+}
+
+/*
+ * /proc/socket_cgroups：每个有 sock_cg 的 cgroup 一行
+ *
+ *	<cgroup 路径> <socket 数> <上限> <priority_level>
+ *
+ * 上限和 priority_level 为 -1 表示没有设置（只是作为祖先补上的）。路径
+ * 相对于读者所在的 cgroup 命名空间。
+ */
+static int sock_cg_show(struct seq_file *m, void *v)
+{
+	struct cgroup_namespace *ns = current->nsproxy->cgroup_ns;
+	struct sock_cg *cg;
+	unsigned long id;
+	char *buf;
+
+	buf = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	mutex_lock(&sock_cg_lock);
+	xa_for_each(&sock_cg_xa, id, cg) {
+		struct cgroup *cgrp = cgroup_get_from_id(id);
+
+		/* 已经删掉、还没清理的不显示 */
+		if (!cgrp)
+			continue;
+		if (cgroup_path_ns(cgrp, buf, PATH_MAX, ns) >= 0)
+			seq_printf(m, "%s %d %d %d\n", buf,
+				   atomic_read(&cg->count), READ_ONCE(cg->max),
+				   READ_ONCE(cg->priority_level));
+		cgroup_put(cgrp);
+	}
+	mutex_unlock(&sock_cg_lock);
+	kfree(buf);
+	return 0;
+}
+
+static int __init sock_cg_init(void)
+{
+	proc_create_single("socket_cgroups", 0444, NULL, sock_cg_show);
+	return 0;
+}
+fs_initcall(sock_cg_init);
@@ -0,0 +1,386 @@
+#include <linux/sched.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/capability.h>
+#include <linux/user_namespace.h>
+#include <linux/uaccess.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fdtable.h>
+#include <linux/net.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/pkt_sched.h>
+#include <linux/socket_attrs.h>
+#include <net/sock.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/inet_ecn.h>
+
+/*
+ * 线程的 priority_level（0~100）到 socket 上实际生效的参数的映射：
+ * sk_priority（决定 qdisc 的 band/class）、IP TOS 或 IPv6 traffic class、
+ * SO_MARK 和 SO_MAX_PACING_RATE。表通过 /proc/socket_priority_map 读写，
+ * 写的格式是一行
+ *
+ *	<level>[-<level>] <sk_priority> <tos> <mark> <max_pacing_rate>
+ *
+ * max_pacing_rate 以字节/秒为单位，0 表示不限速。
+ *
+ * 整张表用 RCU 发布，改表时复制一份再替换，建 socket 时读表不加锁。
+ * 改表只影响之后设置的 socket，已有的 socket 在所属线程的 priority_level
+ * 被重新设置时更新。更新时只改仍是上次按表设的值的字段（记在
+ * sock_prio_applied 里），用户用 SO_PRIORITY、IP_TOS、SO_MARK 等自己
+ * 设过的保持不变。
+ *
+ * 线程的发送限速（sock_rate.c）也压在 TCP socket 的 pacing 上限上，和表
+ * 里的 max_pacing_rate 一起记在 sock_prio_applied 里，两边各改各的，
+ * 生效的是小的那个；限速调高或取消时放开。
+ */
+
+#define SOCK_PRIO_LEVELS	101
+
+struct sock_prio_ent {
+	u32 priority;
+	u8 tos;
+	u32 mark;
+	unsigned long max_pacing_rate;	/* ~0UL 表示不限速 */
+};
+
+struct sock_prio_map {
+	struct rcu_head rcu;
+	struct sock_prio_ent ent[SOCK_PRIO_LEVELS];
+};
+
+static struct sock_prio_map __rcu *sock_prio_map;
+static DEFINE_MUTEX(sock_prio_map_lock);
+
+/*
+ * 默认把 1~100 分成三档，分别落进 pfifo_fast 的三个 band：
+ * 低档是批量传输（CS1），中档是普通流量，高档是要低延迟的交互流量（EF）。
+ */
+static void sock_prio_map_defaults(struct sock_prio_map *map)
+{
+	int level;
+
+	for (level = 0; level < SOCK_PRIO_LEVELS; level++) {
+		struct sock_prio_ent *e = &map->ent[level];
+
+		e->mark = 0;
+		e->max_pacing_rate = ~0UL;
+		if (!level) {
+			e->priority = 0;
+			e->tos = 0;
+		} else if (level <= 33) {
+			e->priority = TC_PRIO_BULK;
+			e->tos = 0x20;
+		} else if (level <= 66) {
+			e->priority = TC_PRIO_BESTEFFORT;
+			e->tos = 0;
+		} else {
+			e->priority = TC_PRIO_INTERACTIVE;
+			e->tos = 0xb8;
+		}
+	}
+}
+
+static bool sock_prio_map_get(int level, struct sock_prio_ent *e)
+{
+	struct sock_prio_map *map;
+
+	if (level < 0 || level >= SOCK_PRIO_LEVELS)
+		return false;
+	rcu_read_lock();
+	map = rcu_dereference(sock_prio_map);
+	if (map)
+		*e = map->ent[level];
+	rcu_read_unlock();
+	return map;
+}
+
+/* @sk 当前的 TOS 或 IPv6 traffic class，别的协议族为 0 */
+static u8 sock_prio_map_tos(struct sock *sk)
+{
+	if (sk->sk_family == AF_INET)
+		return inet_sk(sk)->tos;
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6 && inet6_sk(sk))
+		return inet6_sk(sk)->tclass;
+#endif
+	return 0;
+}
+
+/*
+ * 调用者持有 socket 锁。同 __ip_sock_set_tos()，但不按 TOS 改
+ * sk_priority，优先级由表决定。
+ */
+static void sock_prio_map_set_tos(struct sock *sk, u8 tos)
+{
+	if (sk->sk_family == AF_INET) {
+		struct inet_sock *inet = inet_sk(sk);
+
+		if (sk->sk_type == SOCK_STREAM)
+			tos = (tos & ~INET_ECN_MASK) | (inet->tos & INET_ECN_MASK);
+		if (inet->tos != tos) {
+			inet->tos = tos;
+			sk_dst_reset(sk);
+		}
+	}
+#if IS_ENABLED(CONFIG_IPV6)
+	if (sk->sk_family == AF_INET6 && inet6_sk(sk))
+		inet6_sk(sk)->tclass = tos;
+#endif
+}
+
+/* 调用者持有 socket 锁。第一次设置前记下 socket 当前的值 */
+static void sock_prio_map_snapshot(struct sock *sk,
+				   struct sock_prio_applied *old)
+{
+	if (old->valid)
+		return;
+	old->priority = sk->sk_priority;
+	old->tos = sock_prio_map_tos(sk);
+	old->mark = sk->sk_mark;
+	old->max_pacing_rate = sk->sk_max_pacing_rate;
+	old->valid = true;
+}
+
+/* 按表和线程限速应该生效的 pacing 上限 */
+static unsigned long sock_prio_map_pacing(const struct sock_prio_applied *old)
+{
+	if (old->rate_cap)
+		return min(old->max_pacing_rate, old->rate_cap);
+	return old->max_pacing_rate;
+}
+
+/* 调用者持有 socket 锁。同 SO_MAX_PACING_RATE */
+static void sock_prio_map_set_pacing(struct sock *sk, unsigned long rate)
+{
+	if (rate != ~0UL)
+		cmpxchg(&sk->sk_pacing_status, SK_PACING_NONE,
+			SK_PACING_NEEDED);
+	WRITE_ONCE(sk->sk_max_pacing_rate, rate);
+	sk->sk_pacing_rate = min(sk->sk_pacing_rate, rate);
+}
+
+/*
+ * 按 @level 设置 @sock，调用者在进程上下文，socket 已经由协议初始化完。
+ * 只改上次按表设置以后没被用户改过的字段。
+ */
+void sock_prio_map_apply(struct socket *sock, int level)
+{
+	struct sock_prio_applied *old = sock_acct_prio(sock);
+	struct sock *sk = sock->sk;
+	struct sock_prio_ent e;
+
+	if (!sk || !old || !sock_prio_map_get(level, &e))
+		return;
+
+	lock_sock(sk);
+	sock_prio_map_snapshot(sk, old);
+	if (sock_prio_map_tos(sk) == old->tos) {
+		sock_prio_map_set_tos(sk, e.tos);
+		old->tos = sock_prio_map_tos(sk);
+	}
+	if (sk->sk_priority == old->priority) {
+		sk->sk_priority = e.priority;
+		old->priority = e.priority;
+	}
+	if (sk->sk_mark == old->mark) {
+		if (e.mark != sk->sk_mark) {
+			sk->sk_mark = e.mark;
+			sk_dst_reset(sk);
+		}
+		old->mark = e.mark;
+	}
+	if (sk->sk_max_pacing_rate == sock_prio_map_pacing(old)) {
+		old->max_pacing_rate = e.max_pacing_rate;
+		sock_prio_map_set_pacing(sk, sock_prio_map_pacing(old));
+	}
+	release_sock(sk);
+}
+
+/*
+ * 把线程的发送限速 @rate（字节/秒，0 表示不限速）压到 TCP socket 的
+ * pacing 上限上。@lower 时只调低不调高：发送路径上调用，socket 可能被
+ * 几个线程用过，按最严的那个。否则按 @rate 重新设，限速调高或取消时
+ * 放开。用户自己用 SO_MAX_PACING_RATE 设过的不动。
+ */
+void sock_prio_map_cap(struct socket *sock, unsigned long rate, bool lower)
+{
+	struct sock_prio_applied *old = sock_acct_prio(sock);
+	struct sock *sk = sock->sk;
+	unsigned long cap;
+	bool user;
+
+	if (!sk || !old || sk->sk_type != SOCK_STREAM ||
+	    (sk->sk_family != AF_INET && sk->sk_family != AF_INET6))
+		return;
+	/* 发送路径的快路径：已经压得够低了，不拿锁 */
+	cap = READ_ONCE(old->rate_cap);
+	if (lower && (!rate || (cap && cap <= rate)))
+		return;
+
+	lock_sock(sk);
+	sock_prio_map_snapshot(sk, old);
+	cap = old->rate_cap;
+	if (lower && cap && cap <= rate)
+		goto out;
+	/* 用户改过的也记下 rate_cap，省得每次发送都来拿锁 */
+	user = sk->sk_max_pacing_rate != sock_prio_map_pacing(old);
+	WRITE_ONCE(old->rate_cap, rate);
+	if (!user)
+		sock_prio_map_set_pacing(sk, sock_prio_map_pacing(old));
+out:
+	release_sock(sk);
+}
+
+/*
+ * @task 的 priority_level 或发送限速变了（@what 是 SOCK_PRIO_UPDATE_*），
+ * 把它名下已经打开的 socket 也改过来。@group 时改整个线程组名下的
+ * socket（SOCKET_ATTR_RECURSIVE，组里的线程已经都设成了同一个值）。
+ * 只看得到 @task 的文件表里的 socket，传给了别的进程的不管。
+ */
+void sock_prio_map_update_task(struct task_struct *task, bool group,
+			       unsigned int what)
+{
+	struct sock_acct *acct = READ_ONCE(task->sock_acct);
+	int level = READ_ONCE(task->priority_level);
+	u64 rate = READ_ONCE(task->sock_rate);
+	unsigned int fd = 0;
+
+	/* @task 自己没开过 socket 时组的汇总挂在组长的计数上 */
+	if (!acct && group)
+		acct = READ_ONCE(task->group_leader->sock_acct);
+	if (!acct)
+		return;
+	if (group)
+		acct = acct->group;
+
+	for (;; fd++) {
+		struct sock_acct *owner;
+		struct socket *sock;
+		struct file *file;
+
+		rcu_read_lock();
+		file = task_lookup_next_fd_rcu(task, &fd);
+		if (file && !get_file_rcu(file))
+			file = NULL;
+		rcu_read_unlock();
+		if (!file)
+			break;
+
+		sock = sock_from_file(file);
+		if (sock) {
+			owner = sock_acct_owner(sock);
+			if (owner && (owner == acct || owner->group == acct)) {
+				if (what & SOCK_PRIO_UPDATE_LEVEL)
+					sock_prio_map_apply(sock, level);
+				if (what & SOCK_PRIO_UPDATE_RATE)
+					sock_prio_map_cap(sock,
+							  min_t(u64, rate, ~0UL),
+							  false);
+			}
+		}
+		fput(file);
+	}
+}
+
+static int sock_prio_map_show(struct seq_file *m, void *v)
+{
+	struct sock_prio_map *map;
+	int level;
+
+	rcu_read_lock();
+	map = rcu_dereference(sock_prio_map);
+	for (level = 0; map && level < SOCK_PRIO_LEVELS; level++) {
+		struct sock_prio_ent *e = &map->ent[level];
+
+		seq_printf(m, "%d %u %u %u %lu\n", level, e->priority, e->tos,
+			   e->mark,
+			   e->max_pacing_rate == ~0UL ? 0 : e->max_pacing_rate);
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static int sock_prio_map_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sock_prio_map_show, NULL);
+}
+
+static ssize_t sock_prio_map_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct sock_prio_map *map, *old;
+	unsigned int priority, tos, mark;
+	unsigned long rate;
+	int from, to, n;
+	char buf[96];
+
+	/* 按打开文件时的凭据检查，和 fd 后来落到谁手里无关 */
+	if (!file_ns_capable(file, &init_user_ns, CAP_NET_ADMIN))
+		return -EPERM;
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	n = sscanf(buf, "%d-%d %u %u %u %lu", &from, &to, &priority, &tos,
+		   &mark, &rate);
+	if (n != 6) {
+		n = sscanf(buf, "%d %u %u %u %lu", &from, &priority, &tos,
+			   &mark, &rate);
+		if (n != 5)
+			return -EINVAL;
+		to = from;
+	}
+	if (from < 0 || to < from || to >= SOCK_PRIO_LEVELS || tos > 0xff)
+		return -EINVAL;
+
+	map = kmalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	mutex_lock(&sock_prio_map_lock);
+	old = rcu_dereference_protected(sock_prio_map,
+					lockdep_is_held(&sock_prio_map_lock));
+	memcpy(map->ent, old->ent, sizeof(map->ent));
+	for (n = from; n <= to; n++) {
+		map->ent[n].priority = priority;
+		map->ent[n].tos = tos;
+		map->ent[n].mark = mark;
+		map->ent[n].max_pacing_rate = rate ? rate : ~0UL;
+	}
+	rcu_assign_pointer(sock_prio_map, map);
+	mutex_unlock(&sock_prio_map_lock);
+	kfree_rcu(old, rcu);
+	return count;
+}
+
+static const struct proc_ops sock_prio_map_proc_ops = {
+	.proc_open	= sock_prio_map_open,
+	.proc_read	= seq_read,
+	.proc_write	= sock_prio_map_write,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+static int __init sock_prio_map_init(void)
+{
+	struct sock_prio_map *map;
+
+	map = kmalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	sock_prio_map_defaults(map);
+	rcu_assign_pointer(sock_prio_map, map);
+	proc_create("socket_priority_map", 0644, NULL,
+		    &sock_prio_map_proc_ops);
+	return 0;
+}
+fs_initcall(sock_prio_map_init);
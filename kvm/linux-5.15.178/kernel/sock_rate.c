@@ -0,0 +1,78 @@
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/timekeeping.h>
+#include <linux/net.h>
+#include <linux/socket.h>
+#include <linux/socket_attrs.h>
+#include <net/sock.h>
+
+/*
+ * 每线程的发送限速（set_thread_socket_attrs2() 设置），线程通过所有
+ * socket 发出的字节合在一起算。用 GCRA 实现令牌桶，状态只有一个
+ * 原子的 TAT（理论到达时间，ns）：每条消息把 TAT 往后推 len/rate，
+ * TAT 超前现在不超过 burst/rate 就放行，否则阻塞等到够了为止，
+ * MSG_DONTWAIT 时返回 -EAGAIN。更新 TAT 用 cmpxchg，不拿锁。
+ *
+ * 放行之后真正的发包节奏交给协议：TCP socket 的 sk_max_pacing_rate
+ * 压到线程的速率（sock_prio_map_cap()，限速调高或取消时由
+ * set_thread_socket_attrs2() 放开），TCP 按它给每个包算发送时间（EDT），
+ * fq 等按时间戳调度的 qdisc 据此把突发摊开。数据报的 skb 时间戳在 IP
+ * 层设置，这里只做准入控制。
+ *
+ * 限速是线程的，不是 socket 的：非阻塞发送返回 -EAGAIN 时 socket 本身
+ * 仍然可写，poll/epoll 照样报 EPOLLOUT，不会等到额度恢复再唤醒。事件
+ * 循环拿到 -EAGAIN 后应该自己定时重试，不能指望 EPOLLOUT，否则会空转。
+ *
+ * 只管用户建的 INET socket：内核自己的 socket（记不到线程名下）、
+ * AF_UNIX、netlink 这些本机通信不限速，免得线程被自己的限速卡住。
+ * sendmsg 和 sendfile/splice 走的 ->sendpage 都经过这里。
+ */
+
+/*
+ * 当前线程要通过 @sock 发 @len 字节，按它的限速等到可以发为止。@flags
+ * 是发送的 MSG_* 标志。返回 0 表示放行，-EAGAIN 表示非阻塞发送超了速，
+ * -ERESTARTSYS 表示等待时来了信号。
+ */
+int sock_rate_wait(struct socket *sock, size_t len, int flags)
+{
+	struct task_struct *tsk = current;
+	u64 rate = READ_ONCE(tsk->sock_rate);
+	struct sock *sk = sock->sk;
+	u64 interval, tau, tat, now, start;
+
+	if (!rate || !sk || !sock_acct_owner(sock))
+		return 0;
+	if (sk->sk_family != AF_INET && sk->sk_family != AF_INET6)
+		return 0;
+	interval = mul_u64_u64_div_u64(len, NSEC_PER_SEC, rate);
+	tau = mul_u64_u64_div_u64(READ_ONCE(tsk->sock_burst), NSEC_PER_SEC,
+				  rate);
+
+	for (;;) {
+		tat = atomic64_read(&tsk->sock_tat);
+		now = ktime_get_ns();
+		start = max(tat, now);
+		if (start - now > tau) {
+			ktime_t expires = ns_to_ktime(start - now - tau);
+
+			if (flags & MSG_DONTWAIT)
+				return -EAGAIN;
+			set_current_state(TASK_INTERRUPTIBLE);
+			schedule_hrtimeout_range(&expires, tsk->timer_slack_ns,
+						 HRTIMER_MODE_REL);
+			if (signal_pending(tsk))
+				return -ERESTARTSYS;
+			continue;
+		}
+		if (atomic64_cmpxchg(&tsk->sock_tat, tat, start + interval) == tat)
+			break;
+	}
+	sock_prio_map_cap(sock, min_t(u64, rate, ~0UL), true);
+	return 0;
+}
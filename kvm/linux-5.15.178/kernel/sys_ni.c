@@ -193,6 +193,24 @@ COND_SYSCALL(getgroups);
 /* kernel/kv_store.c */
 COND_SYSCALL(write_kv);
 COND_SYSCALL(read_kv);
+COND_SYSCALL(write_kv_batch);
+COND_SYSCALL(read_kv_batch);
+COND_SYSCALL(kv_put);
+COND_SYSCALL(kv_get);
+COND_SYSCALL(delete_kv);
+COND_SYSCALL(scan_kv);
+COND_SYSCALL(kv_ctl);
+COND_SYSCALL(kv_fetch_add);
+COND_SYSCALL(kv_cas);
+COND_SYSCALL(kv_dump);
+COND_SYSCALL(kv_load);
+COND_SYSCALL(kv_ns_open);
+COND_SYSCALL(kv_ns_unlink);
+COND_SYSCALL(kv_expire);
+COND_SYSCALL(kv_ring_setup);
+COND_SYSCALL(kv_ring_enter);
+COND_SYSCALL(set_cgroup_socket_attrs);
+COND_SYSCALL(set_thread_socket_attrs2);
 
 /* ipc/mqueue.c */
 COND_SYSCALL(mq_open);
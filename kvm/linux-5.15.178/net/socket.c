@@ -86,6 +86,7 @@
 #include <linux/xattr.h>
 #include <linux/nospec.h>
 #include <linux/indirect_call_wrapper.h>
+#include <linux/socket_attrs.h>
 
 #include <linux/uaccess.h>
 #include <asm/unistd.h>
@@ -641,6 +642,7 @@ EXPORT_SYMBOL(sock_alloc);
 
 static void __sock_release(struct socket *sock, struct inode *inode)
 {
+	sock_acct_uncharge(sock);
 	if (sock->ops) {
 		struct module *owner = sock->ops->owner;
 
@@ -699,12 +701,32 @@ INDIRECT_CALLABLE_DECLARE(int inet_sendmsg(struct socket *, struct msghdr *,
 					   size_t));
 INDIRECT_CALLABLE_DECLARE(int inet6_sendmsg(struct socket *, struct msghdr *,
 					    size_t));
+/*
+ * 收发计数记到当前线程头上，只有它自己写，不用原子操作。只算记在线程
+ * 名下的 socket，内核自己建的 socket 上的流量不算到碰巧在跑的线程头上。
+ */
+static inline void sock_count_tx(struct socket *sock, int ret)
+{
+	if (ret > 0 && sock_acct_owner(sock)) {
+		current->sock_tx_bytes += ret;
+		current->sock_tx_msgs++;
+	}
+}
+
 static inline int sock_sendmsg_nosec(struct socket *sock, struct msghdr *msg)
 {
-	int ret = INDIRECT_CALL_INET(sock->ops->sendmsg, inet6_sendmsg,
-				     inet_sendmsg, sock, msg,
-				     msg_data_left(msg));
+	int ret;
+
+	/* 线程设置了发送限速，先按令牌桶等到可以发 */
+	if (unlikely(READ_ONCE(current->sock_rate))) {
+		ret = sock_rate_wait(sock, msg_data_left(msg), msg->msg_flags);
+		if (ret)
+			return ret;
+	}
+	ret = INDIRECT_CALL_INET(sock->ops->sendmsg, inet6_sendmsg,
+				 inet_sendmsg, sock, msg, msg_data_left(msg));
 	BUG_ON(ret == -EIOCBQUEUED);
+	sock_count_tx(sock, ret);
 	return ret;
 }
 
@@ -963,9 +985,16 @@ INDIRECT_CALLABLE_DECLARE(int inet6_recvmsg(struct socket *, struct msghdr *,
 static inline int sock_recvmsg_nosec(struct socket *sock, struct msghdr *msg,
 				     int flags)
 {
-	return INDIRECT_CALL_INET(sock->ops->recvmsg, inet6_recvmsg,
-				  inet_recvmsg, sock, msg, msg_data_left(msg),
-				  flags);
+	int ret = INDIRECT_CALL_INET(sock->ops->recvmsg, inet6_recvmsg,
+				     inet_recvmsg, sock, msg,
+				     msg_data_left(msg), flags);
+
+	/* MSG_PEEK 没有取走数据，不算；内核的 socket 同发送一样不算 */
+	if (ret > 0 && !(flags & MSG_PEEK) && sock_acct_owner(sock)) {
+		current->sock_rx_bytes += ret;
+		current->sock_rx_msgs++;
+	}
+	return ret;
 }
 
 /**
@@ -1014,7 +1043,7 @@ static ssize_t sock_sendpage(struct file *file, struct page *page,
 			     int offset, size_t size, loff_t *ppos, int more)
 {
 	struct socket *sock;
-	int flags;
+	int flags, ret;
 
 	sock = file->private_data;
 
@@ -1022,7 +1051,15 @@ static ssize_t sock_sendpage(struct file *file, struct page *page,
 	/* more is a combination of MSG_MORE and MSG_SENDPAGE_NOTLAST */
 	flags |= more;
 
-	return kernel_sendpage(sock, page, offset, size, flags);
+	/* sendfile/splice 也受线程的发送限速，也记发送计数 */
+	if (unlikely(READ_ONCE(current->sock_rate))) {
+		ret = sock_rate_wait(sock, size, flags);
+		if (ret)
+			return ret;
+	}
+	ret = kernel_sendpage(sock, page, offset, size, flags);
+	sock_count_tx(sock, ret);
+	return ret;
 }
 
 static ssize_t sock_splice_read(struct file *file, loff_t *ppos,
@@ -1415,7 +1452,7 @@ EXPORT_SYMBOL(sock_wake_async);
 int __sock_create(struct net *net, int family, int type, int protocol,
 			 struct socket **res, int kern)
 {
-	int err;
+	int err, level;
 	struct socket *sock;
 	const struct net_proto_family *pf;
 
@@ -1429,7 +1466,7 @@ int __sock_create(struct net *net, int family, int type, int protocol,
 
 	/* 添加Socket数量检查 */
     if (!kern && current->max_socket_allowed > 0) {
-        if (current->socket_count >= current->max_socket_allowed) {
+        if (sock_acct_count(current) >= current->max_socket_allowed) {
             return -EMFILE; /* 超出线程允许的Socket数量限制 */
         }
     }
@@ -1514,10 +1551,17 @@ int __sock_create(struct net *net, int family, int type, int protocol,
 	err = security_socket_post_create(sock, family, type, protocol, kern);
 	if (err)
 		goto out_sock_release;
+	/* 创建成功，记到当前线程名下，sock_release() 时减掉 */
+	if (!kern) {
+		err = sock_acct_charge(sock);
+		if (err)
+			goto out_sock_release;
+		/* 按映射表把线程或 cgroup 的 priority_level 落到 socket 上 */
+		level = sock_acct_priority_level(sock);
+		if (level > 0)
+			sock_prio_map_apply(sock, level);
+	}
 	*res = sock;
-	/* 创建成功，增加计数 */
-    if (!kern)
-        current->socket_count++;
 	return 0;
 
 out_module_busy: